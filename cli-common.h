@@ -19,7 +19,30 @@
   along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <math.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "external/liblrhsmm/inference.h"
+#include "external/liblrhsmm/estimate.h"
+#include "feature-io.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
 
 inline static bool read_bytes(void* data, size_t sz, FILE* fh) {
   return fread(data, sizeof(uint8_t), sz, fh) == (sz * sizeof(uint8_t));
@@ -33,6 +56,118 @@ inline static size_t file_writer(cmp_ctx_t* ctx, const void* data, size_t count)
   return fwrite(data, sizeof(uint8_t), count, (FILE*)ctx->buf);
 }
 
+/*
+  Buffered cmp backend. A read buffer either holds an entire file in memory
+    or serves as a read-ahead window over a stream; a write buffer collects
+    the tokens and flushes them to the stream in large blocks.
+*/
+
+#define CMP_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+  FILE* fh;
+  uint8_t* data;
+  size_t size;
+  size_t pos;
+  size_t capacity;
+} cmp_buffer;
+
+static cmp_buffer* create_cmp_buffer(FILE* fh) {
+  cmp_buffer* ret = malloc(sizeof(cmp_buffer));
+  ret -> fh = fh;
+  ret -> capacity = CMP_BUFFER_SIZE;
+  ret -> data = malloc(ret -> capacity);
+  ret -> size = 0;
+  ret -> pos = 0;
+  return ret;
+}
+
+static cmp_buffer* create_cmp_buffer_from_file(const char* path) {
+  FILE* fin = fopen(path, "rb");
+  if(fin == NULL) return NULL;
+  fseek(fin, 0, SEEK_END);
+  long fsize = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  cmp_buffer* ret = malloc(sizeof(cmp_buffer));
+  ret -> fh = NULL;
+  ret -> capacity = fsize > 0 ? fsize : 1;
+  ret -> data = malloc(ret -> capacity);
+  ret -> size = fread(ret -> data, 1, fsize, fin);
+  ret -> pos = 0;
+  fclose(fin);
+  return ret;
+}
+
+static void delete_cmp_buffer(cmp_buffer* dst) {
+  free(dst -> data);
+  free(dst);
+}
+
+static bool buffered_reader(cmp_ctx_t* ctx, void* data, size_t limit) {
+  cmp_buffer* b = ctx -> buf;
+  uint8_t* dst = data;
+  while(limit > 0) {
+    if(b -> pos == b -> size) {
+      if(b -> fh == NULL) return false;
+      b -> size = fread(b -> data, 1, b -> capacity, b -> fh);
+      b -> pos = 0;
+      if(b -> size == 0) return false;
+    }
+    size_t n = b -> size - b -> pos;
+    if(n > limit) n = limit;
+    memcpy(dst, b -> data + b -> pos, n);
+    b -> pos += n;
+    dst += n;
+    limit -= n;
+  }
+  return true;
+}
+
+static void flush_cmp_buffer(cmp_buffer* b) {
+  if(b -> pos > 0)
+    fwrite(b -> data, 1, b -> pos, b -> fh);
+  b -> pos = 0;
+  fflush(b -> fh);
+}
+
+static size_t buffered_writer(cmp_ctx_t* ctx, const void* data, size_t count) {
+  cmp_buffer* b = ctx -> buf;
+  if(count >= b -> capacity) {
+    flush_cmp_buffer(b);
+    return fwrite(data, 1, count, b -> fh);
+  }
+  if(b -> pos + count > b -> capacity)
+    flush_cmp_buffer(b);
+  memcpy(b -> data + b -> pos, data, count);
+  b -> pos += count;
+  return count;
+}
+
+static void write_model(FILE* fout, lrh_model* h) {
+  cmp_ctx_t cmpobj;
+  cmp_buffer* b = create_cmp_buffer(fout);
+  cmp_init(& cmpobj, b, buffered_reader, buffered_writer);
+  lrh_write_model(& cmpobj, h);
+  flush_cmp_buffer(b);
+  delete_cmp_buffer(b);
+}
+
+// read a line of arbitrary length; returns NULL on end of file
+static char* read_line(FILE* fin) {
+  int capacity = 4096;
+  int n = 0;
+  char* ret = malloc(capacity);
+  while(fgets(ret + n, capacity - n, fin) != NULL) {
+    n += strlen(ret + n);
+    if(n > 0 && ret[n - 1] == '\n') return ret;
+    capacity *= 2;
+    ret = realloc(ret, capacity);
+  }
+  if(n > 0) return ret;
+  free(ret);
+  return NULL;
+}
+
 static char* readall(const char* path) {
   FILE* fp = fopen(path, "r");
   if(fp == NULL) return NULL;
@@ -46,46 +181,576 @@ static char* readall(const char* path) {
   return ret;
 }
 
+/*
+  Native binary model format.
+
+  header | stream records | duration records | gmm records | tables
+
+  The weights, means, variances and variance floors of all gmms in a stream
+    are stored in four contiguous tables, each aligned to BINMODEL_ALIGN
+    bytes. A model in this format is mapped into memory and used in place
+    instead of being parsed and copied. Offsets and sizes are validated
+    against the file size on load.
+*/
+
+#define BINMODEL_MAGIC "SHIROHSM"
+#define BINMODEL_VERSION 1
+#define BINMODEL_ALIGN 64
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t fpsize;
+  uint32_t nstream;
+  uint32_t nduration;
+  uint64_t size;
+} binmodel_header;
+
+typedef struct {
+  uint32_t ngmm;
+  uint32_t ndim;
+  double weight;
+  uint64_t nmixtotal;
+  uint64_t gmm_offset;
+  uint64_t weight_offset;
+  uint64_t mean_offset;
+  uint64_t var_offset;
+  uint64_t vfloor_offset;
+} binmodel_stream;
+
+typedef struct {
+  double mean;
+  double var;
+  double floor;
+  double ceil;
+} binmodel_duration;
+
+typedef struct {
+  uint64_t mixbase;
+  uint32_t nmix;
+  uint32_t reserved;
+} binmodel_gmm;
+
+// models whose gmm tables point into a mapped file
+typedef struct {
+  lrh_model* h;
+  uint8_t* base;
+  size_t size;
+} mapped_model;
+
+#define MAX_MAPPED_MODEL 16
+static mapped_model mapped_models[MAX_MAPPED_MODEL];
+
+static uint64_t binmodel_align(uint64_t offset) {
+  return (offset + BINMODEL_ALIGN - 1) / BINMODEL_ALIGN * BINMODEL_ALIGN;
+}
+
+static int is_binmodel(const char* path) {
+  if(! strcmp(path, "-")) return 0;
+  FILE* fin = fopen(path, "rb");
+  if(fin == NULL) return 0;
+  char magic[8];
+  int ret = fread(magic, 1, 8, fin) == 8 && ! memcmp(magic, BINMODEL_MAGIC, 8);
+  fclose(fin);
+  return ret;
+}
+
+static void write_padding(FILE* fout, uint64_t* offset, uint64_t target) {
+  static const uint8_t zeros[BINMODEL_ALIGN] = {0};
+  while(*offset < target) {
+    uint64_t n = target - *offset;
+    if(n > BINMODEL_ALIGN) n = BINMODEL_ALIGN;
+    fwrite(zeros, 1, n, fout);
+    *offset += n;
+  }
+}
+
+static void write_model_bin(FILE* fout, lrh_model* h) {
+  int nstream = h -> nstream;
+  binmodel_header header;
+  binmodel_stream* streams = calloc(nstream, sizeof(binmodel_stream));
+  memcpy(header.magic, BINMODEL_MAGIC, 8);
+  header.version = BINMODEL_VERSION;
+  header.fpsize = sizeof(FP_TYPE);
+  header.nstream = nstream;
+  header.nduration = h -> nduration;
+
+  // layout
+  uint64_t offset = sizeof(binmodel_header) +
+    nstream * sizeof(binmodel_stream) +
+    h -> nduration * sizeof(binmodel_duration);
+  for(int l = 0; l < nstream; l ++) {
+    lrh_stream* s = h -> streams[l];
+    streams[l].ngmm = s -> ngmm;
+    streams[l].ndim = s -> ngmm > 0 ? s -> gmms[0] -> ndim : 0;
+    streams[l].weight = s -> weight;
+    streams[l].nmixtotal = 0;
+    for(int i = 0; i < s -> ngmm; i ++)
+      streams[l].nmixtotal += s -> gmms[i] -> nmix;
+    streams[l].gmm_offset = offset;
+    offset += s -> ngmm * sizeof(binmodel_gmm);
+  }
+  for(int l = 0; l < nstream; l ++) {
+    uint64_t nmixtotal = streams[l].nmixtotal;
+    uint64_t ndim = streams[l].ndim;
+    streams[l].weight_offset = offset = binmodel_align(offset);
+    offset += nmixtotal * sizeof(FP_TYPE);
+    streams[l].mean_offset = offset = binmodel_align(offset);
+    offset += nmixtotal * ndim * sizeof(FP_TYPE);
+    streams[l].var_offset = offset = binmodel_align(offset);
+    offset += nmixtotal * ndim * sizeof(FP_TYPE);
+    streams[l].vfloor_offset = offset = binmodel_align(offset);
+    offset += nmixtotal * ndim * sizeof(FP_TYPE);
+  }
+  header.size = offset;
+
+  // records
+  offset = 0;
+  fwrite(& header, sizeof(binmodel_header), 1, fout);
+  fwrite(streams, sizeof(binmodel_stream), nstream, fout);
+  offset += sizeof(binmodel_header) + nstream * sizeof(binmodel_stream);
+  for(int i = 0; i < h -> nduration; i ++) {
+    binmodel_duration d;
+    d.mean  = h -> durations[i] -> mean;
+    d.var   = h -> durations[i] -> var;
+    d.floor = h -> durations[i] -> floor;
+    d.ceil  = h -> durations[i] -> ceil;
+    fwrite(& d, sizeof(binmodel_duration), 1, fout);
+    offset += sizeof(binmodel_duration);
+  }
+  for(int l = 0; l < nstream; l ++) {
+    lrh_stream* s = h -> streams[l];
+    uint64_t mixbase = 0;
+    for(int i = 0; i < s -> ngmm; i ++) {
+      binmodel_gmm g;
+      g.mixbase = mixbase;
+      g.nmix = s -> gmms[i] -> nmix;
+      g.reserved = 0;
+      fwrite(& g, sizeof(binmodel_gmm), 1, fout);
+      mixbase += g.nmix;
+    }
+    offset += s -> ngmm * sizeof(binmodel_gmm);
+  }
+
+  // tables
+  for(int l = 0; l < nstream; l ++) {
+    lrh_stream* s = h -> streams[l];
+    int ndim = streams[l].ndim;
+    write_padding(fout, & offset, streams[l].weight_offset);
+    for(int i = 0; i < s -> ngmm; i ++)
+      fwrite(s -> gmms[i] -> weight, sizeof(FP_TYPE), s -> gmms[i] -> nmix, fout);
+    offset += streams[l].nmixtotal * sizeof(FP_TYPE);
+    write_padding(fout, & offset, streams[l].mean_offset);
+    for(int i = 0; i < s -> ngmm; i ++)
+      fwrite(s -> gmms[i] -> mean, sizeof(FP_TYPE), s -> gmms[i] -> nmix * ndim,
+        fout);
+    offset += streams[l].nmixtotal * ndim * sizeof(FP_TYPE);
+    write_padding(fout, & offset, streams[l].var_offset);
+    for(int i = 0; i < s -> ngmm; i ++)
+      fwrite(s -> gmms[i] -> var, sizeof(FP_TYPE), s -> gmms[i] -> nmix * ndim,
+        fout);
+    offset += streams[l].nmixtotal * ndim * sizeof(FP_TYPE);
+    write_padding(fout, & offset, streams[l].vfloor_offset);
+    for(int i = 0; i < s -> ngmm; i ++)
+      fwrite(s -> gmms[i] -> vfloor, sizeof(FP_TYPE),
+        s -> gmms[i] -> nmix * ndim, fout);
+    offset += streams[l].nmixtotal * ndim * sizeof(FP_TYPE);
+  }
+  fflush(fout);
+  free(streams);
+}
+
+static uint8_t* map_file(const char* path, size_t* size) {
+# ifdef _WIN32
+  FILE* fin = fopen(path, "rb");
+  if(fin == NULL) return NULL;
+  fseek(fin, 0, SEEK_END);
+  *size = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  uint8_t* base = malloc(*size);
+  if(fread(base, 1, *size, fin) != *size) {
+    free(base);
+    base = NULL;
+  }
+  fclose(fin);
+  return base;
+# else
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat st;
+  if(fstat(fd, & st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  *size = st.st_size;
+  // private writable mapping: re-estimation updates the model in place
+  //   without touching the file
+  void* base = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  return base == MAP_FAILED ? NULL : base;
+# endif
+}
+
+static void unmap_file(uint8_t* base, size_t size) {
+# ifdef _WIN32
+  free(base);
+# else
+  munmap(base, size);
+# endif
+}
+
+// whether [offset, offset + count * unit) lies within a file of the given size
+static int binmodel_range(uint64_t offset, uint64_t count, uint64_t unit,
+  uint64_t size) {
+  if(offset > size) return 0;
+  if(unit != 0 && count > (size - offset) / unit) return 0;
+  return 1;
+}
+
+// validate the records and table extents against the mapped size
+static int binmodel_check(uint8_t* base, size_t size) {
+  binmodel_header* header = (binmodel_header*)base;
+  uint64_t nstream = header -> nstream;
+  if(! binmodel_range(sizeof(binmodel_header), nstream,
+    sizeof(binmodel_stream), size)) return 0;
+  binmodel_stream* streams = (binmodel_stream*)(base + sizeof(binmodel_header));
+  if(! binmodel_range(sizeof(binmodel_header) + nstream *
+    sizeof(binmodel_stream), header -> nduration, sizeof(binmodel_duration),
+    size)) return 0;
+  for(uint64_t l = 0; l < nstream; l ++) {
+    binmodel_stream* bs = & streams[l];
+    uint64_t nmixtotal = bs -> nmixtotal;
+    uint64_t ntable = bs -> ndim == 0 ? 0 : nmixtotal;
+    if(bs -> ndim != 0 && nmixtotal > size / bs -> ndim) return 0;
+    if(! binmodel_range(bs -> gmm_offset, bs -> ngmm, sizeof(binmodel_gmm),
+           size) ||
+       ! binmodel_range(bs -> weight_offset, nmixtotal, sizeof(FP_TYPE), size) ||
+       ! binmodel_range(bs -> mean_offset, ntable * bs -> ndim,
+           sizeof(FP_TYPE), size) ||
+       ! binmodel_range(bs -> var_offset, ntable * bs -> ndim,
+           sizeof(FP_TYPE), size) ||
+       ! binmodel_range(bs -> vfloor_offset, ntable * bs -> ndim,
+           sizeof(FP_TYPE), size))
+      return 0;
+    if(bs -> gmm_offset % sizeof(uint64_t) != 0 ||
+       bs -> weight_offset % sizeof(FP_TYPE) != 0 ||
+       bs -> mean_offset % sizeof(FP_TYPE) != 0 ||
+       bs -> var_offset % sizeof(FP_TYPE) != 0 ||
+       bs -> vfloor_offset % sizeof(FP_TYPE) != 0)
+      return 0;
+    binmodel_gmm* gmms = (binmodel_gmm*)(base + bs -> gmm_offset);
+    for(uint64_t i = 0; i < bs -> ngmm; i ++)
+      if(gmms[i].mixbase > nmixtotal || gmms[i].nmix > nmixtotal -
+         gmms[i].mixbase)
+        return 0;
+  }
+  return 1;
+}
+
+static lrh_model* load_model_bin(const char* path) {
+  size_t size = 0;
+  uint8_t* base = map_file(path, & size);
+  if(base == NULL) return NULL;
+  binmodel_header* header = (binmodel_header*)base;
+  if(size < sizeof(binmodel_header) || memcmp(header -> magic, BINMODEL_MAGIC, 8)
+    || header -> version != BINMODEL_VERSION || header -> size != size) {
+    fprintf(stderr, "Error: %s is not a valid binary model.\n", path);
+    unmap_file(base, size);
+    return NULL;
+  }
+  if(header -> fpsize != sizeof(FP_TYPE)) {
+    fprintf(stderr, "Error: %s was created with a different floating point "
+      "precision.\n", path);
+    unmap_file(base, size);
+    return NULL;
+  }
+  if(! binmodel_check(base, size)) {
+    fprintf(stderr, "Error: %s is truncated or corrupted.\n", path);
+    unmap_file(base, size);
+    return NULL;
+  }
+
+  int mapidx = 0;
+  while(mapidx < MAX_MAPPED_MODEL && mapped_models[mapidx].base != NULL)
+    mapidx ++;
+  if(mapidx == MAX_MAPPED_MODEL) {
+    fprintf(stderr, "Error: too many mapped models.\n");
+    unmap_file(base, size);
+    return NULL;
+  }
+
+  int nstream = header -> nstream;
+  binmodel_stream* streams = (binmodel_stream*)(base + sizeof(binmodel_header));
+  binmodel_duration* durations = (binmodel_duration*)(streams + nstream);
+  lrh_model* h = lrh_create_empty_model(nstream, header -> nduration);
+  for(int i = 0; i < h -> nduration; i ++) {
+    h -> durations[i] = lrh_create_duration();
+    h -> durations[i] -> mean  = durations[i].mean;
+    h -> durations[i] -> var   = durations[i].var;
+    h -> durations[i] -> floor = durations[i].floor;
+    h -> durations[i] -> ceil  = durations[i].ceil;
+  }
+  for(int l = 0; l < nstream; l ++) {
+    binmodel_stream* bs = & streams[l];
+    binmodel_gmm* gmms = (binmodel_gmm*)(base + bs -> gmm_offset);
+    FP_TYPE* weight = (FP_TYPE*)(base + bs -> weight_offset);
+    FP_TYPE* mean   = (FP_TYPE*)(base + bs -> mean_offset);
+    FP_TYPE* var    = (FP_TYPE*)(base + bs -> var_offset);
+    FP_TYPE* vfloor = (FP_TYPE*)(base + bs -> vfloor_offset);
+    int ndim = bs -> ndim;
+    h -> streams[l] = lrh_create_empty_stream(bs -> ngmm);
+    h -> streams[l] -> weight = bs -> weight;
+    for(int i = 0; i < (int)bs -> ngmm; i ++) {
+      lrh_gmm* g = lrh_create_gmm(gmms[i].nmix, ndim);
+      free(g -> weight); free(g -> mean); free(g -> var); free(g -> vfloor);
+      g -> weight = weight + gmms[i].mixbase;
+      g -> mean   = mean   + gmms[i].mixbase * ndim;
+      g -> var    = var    + gmms[i].mixbase * ndim;
+      g -> vfloor = vfloor + gmms[i].mixbase * ndim;
+      h -> streams[l] -> gmms[i] = g;
+    }
+  }
+
+  mapped_models[mapidx].h = h;
+  mapped_models[mapidx].base = base;
+  mapped_models[mapidx].size = size;
+  return h;
+}
+
+// detach gmm tables residing in a mapped file so that they won't be freed
+static void detach_gmm(lrh_gmm* g) {
+  for(int i = 0; i < MAX_MAPPED_MODEL; i ++) {
+    uint8_t* base = mapped_models[i].base;
+    if(base != NULL && (uint8_t*)g -> mean >= base &&
+      (uint8_t*)g -> mean < base + mapped_models[i].size) {
+      g -> weight = NULL; g -> mean = NULL; g -> var = NULL; g -> vfloor = NULL;
+      return;
+    }
+  }
+}
+
+// lrh_delete_gmm/lrh_delete_model counterparts that are aware of mapped models
+static void delete_gmm(lrh_gmm* g) {
+  detach_gmm(g);
+  lrh_delete_gmm(g);
+}
+
+static void delete_model(lrh_model* h) {
+  if(h == NULL) return;
+  for(int i = 0; i < MAX_MAPPED_MODEL; i ++) {
+    if(mapped_models[i].h != h) continue;
+    for(int l = 0; l < h -> nstream; l ++)
+      for(int j = 0; j < h -> streams[l] -> ngmm; j ++)
+        if(h -> streams[l] -> gmms[j] != NULL)
+          detach_gmm(h -> streams[l] -> gmms[j]);
+    lrh_delete_model(h);
+    unmap_file(mapped_models[i].base, mapped_models[i].size);
+    mapped_models[i].h = NULL;
+    mapped_models[i].base = NULL;
+    return;
+  }
+  lrh_delete_model(h);
+}
+
 static lrh_model* load_model(const char* path) {
+  if(is_binmodel(path))
+    return load_model_bin(path);
   cmp_ctx_t cmpobj;
-  lrh_model* h = NULL;
-  if(! strcmp(path, "-")) {
-    cmp_init(& cmpobj, stdin, file_reader, file_writer);
-    h = lrh_read_model(& cmpobj);
+  cmp_buffer* b = NULL;
+  if(! strcmp(path, "-"))
+    b = create_cmp_buffer(stdin);
+  else
+    b = create_cmp_buffer_from_file(path);
+  if(b == NULL) return NULL;
+  cmp_init(& cmpobj, b, buffered_reader, buffered_writer);
+  lrh_model* h = lrh_read_model(& cmpobj);
+  delete_cmp_buffer(b);
+  return h;
+}
+
+// number of frames in a feature file (of any encoding), given the number of
+//   dimensions per frame; -1 if the file cannot be accessed, -2 if the size
+//   does not match
+static long get_feature_nframe(const char* path, int stride) {
+  return feature_file_nframe(path, stride);
+}
+
+#define checkvar(name) \
+  if(j_##name == NULL) { \
+    fprintf(stderr, "Error: missing JSON attribute: \"%s\"\n", #name); \
+    exit(1); \
+  }
+
+/*
+  Cepstral mean and variance normalization. The statistics are computed by
+    shiro-cmvn and stored in a small JSON file,
+      {"mode": "global" | "speaker" | "utterance", "ndim": n,
+       "groups": [{"name": ..., "mean": [...], "std": [...]}, ...]}
+    where the speaker of a file is the directory it resides in and the group
+    named "*" holds the statistics over the entire corpus. In utterance mode
+    each file is normalized by its own statistics. Once loaded with -N, the
+    normalization is applied to every feature file in load_observ_from_float.
+*/
+
+#define CMVN_GLOBAL 0
+#define CMVN_SPEAKER 1
+#define CMVN_UTTERANCE 2
+
+typedef struct {
+  int mode;
+  int ndim;
+  int ngroup;
+  char** name;
+  FP_TYPE* mean;  // ngroup x ndim
+  FP_TYPE* istd;  // ngroup x ndim, inverse standard deviation
+} cmvn_table;
+
+static cmvn_table* feature_cmvn = NULL;
+
+static int parse_cmvn_mode(const char* name) {
+  if(! strcmp(name, "global")) return CMVN_GLOBAL;
+  if(! strcmp(name, "speaker")) return CMVN_SPEAKER;
+  if(! strcmp(name, "utterance")) return CMVN_UTTERANCE;
+  return -1;
+}
+
+// the speaker of a feature file: its path up to the last separator
+static int cmvn_speaker_length(const char* path) {
+  int n = 0;
+  for(int i = 0; path[i] != 0; i ++)
+    if(path[i] == '/' || path[i] == '\\') n = i;
+  return n;
+}
+
+static cmvn_table* load_cmvn(const char* path) {
+  char* jsonstr = readall(path);
+  if(jsonstr == NULL) return NULL;
+  cJSON* j_cmvn = cJSON_Parse(jsonstr);
+  free(jsonstr);
+  if(j_cmvn == NULL) return NULL;
+  cJSON* j_mode = cJSON_GetObjectItem(j_cmvn, "mode");
+  cJSON* j_ndim = cJSON_GetObjectItem(j_cmvn, "ndim");
+  cJSON* j_groups = cJSON_GetObjectItem(j_cmvn, "groups");
+  checkvar(mode);
+  checkvar(ndim);
+  cmvn_table* ret = calloc(1, sizeof(cmvn_table));
+  ret -> mode = parse_cmvn_mode(j_mode -> valuestring);
+  ret -> ndim = j_ndim -> valueint;
+  ret -> ngroup = j_groups == NULL ? 0 : cJSON_GetArraySize(j_groups);
+  ret -> name = calloc(ret -> ngroup + 1, sizeof(char*));
+  ret -> mean = calloc((ret -> ngroup + 1) * ret -> ndim, sizeof(FP_TYPE));
+  ret -> istd = calloc((ret -> ngroup + 1) * ret -> ndim, sizeof(FP_TYPE));
+  for(int g = 0; g < ret -> ngroup; g ++) {
+    cJSON* j_group = cJSON_GetArrayItem(j_groups, g);
+    cJSON* j_name = cJSON_GetObjectItem(j_group, "name");
+    cJSON* j_mean = cJSON_GetObjectItem(j_group, "mean");
+    cJSON* j_std = cJSON_GetObjectItem(j_group, "std");
+    checkvar(name);
+    checkvar(mean);
+    checkvar(std);
+    ret -> name[g] = malloc(strlen(j_name -> valuestring) + 1);
+    strcpy(ret -> name[g], j_name -> valuestring);
+    if(cJSON_GetArraySize(j_mean) != ret -> ndim ||
+       cJSON_GetArraySize(j_std) != ret -> ndim) {
+      fprintf(stderr, "Error: group %s in %s does not have %d dimensions.\n",
+        ret -> name[g], path, ret -> ndim);
+      exit(1);
+    }
+    for(int j = 0; j < ret -> ndim; j ++) {
+      FP_TYPE std = cJSON_GetArrayItem(j_std, j) -> valuedouble;
+      if(! (std > 0) || ! isfinite(std)) {
+        fprintf(stderr, "Error: invalid standard deviation in dimension %d of "
+          "group %s in %s.\n", j, ret -> name[g], path);
+        exit(1);
+      }
+      ret -> mean[g * ret -> ndim + j] =
+        cJSON_GetArrayItem(j_mean, j) -> valuedouble;
+      ret -> istd[g * ret -> ndim + j] = 1.0 / std;
+    }
+  }
+  cJSON_Delete(j_cmvn);
+  if(ret -> mode < 0 || ret -> ndim <= 0 ||
+    (ret -> mode != CMVN_UTTERANCE && ret -> ngroup == 0)) {
+    fprintf(stderr, "Error: invalid normalization file %s.\n", path);
+    exit(1);
+  }
+  return ret;
+}
+
+static void delete_cmvn(cmvn_table* dst) {
+  if(dst == NULL) return;
+  for(int g = 0; g < dst -> ngroup; g ++)
+    free(dst -> name[g]);
+  free(dst -> name);
+  free(dst -> mean);
+  free(dst -> istd);
+  free(dst);
+}
+
+// normalize nt x ndim frames read from path
+static void apply_cmvn(cmvn_table* c, const char* path, float* x, int nt) {
+  int ndim = c -> ndim;
+  FP_TYPE* mean = NULL;
+  FP_TYPE* istd = NULL;
+  FP_TYPE* local = NULL;
+  if(c -> mode == CMVN_UTTERANCE) {
+    local = calloc(ndim * 2, sizeof(FP_TYPE));
+    mean = local;
+    istd = local + ndim;
+    for(int t = 0; t < nt; t ++)
+      for(int j = 0; j < ndim; j ++) {
+        FP_TYPE v = x[t * ndim + j];
+        mean[j] += v;
+        istd[j] += v * v;
+      }
+    for(int j = 0; j < ndim; j ++) {
+      mean[j] /= max(nt, 1);
+      FP_TYPE var = istd[j] / max(nt, 1) - mean[j] * mean[j];
+      istd[j] = 1.0 / sqrt(max(var, 1e-10));
+    }
   } else {
-    FILE* fin = fopen(path, "rb");
-    if(fin == NULL) return NULL;
-    cmp_init(& cmpobj, fin, file_reader, file_writer);
-    h = lrh_read_model(& cmpobj);
-    fclose(fin);
+    int g = 0;
+    if(c -> mode == CMVN_SPEAKER) {
+      int n = cmvn_speaker_length(path);
+      for(int i = 0; i < c -> ngroup; i ++)
+        if((int)strlen(c -> name[i]) == n && ! strncmp(c -> name[i], path, n)) {
+          g = i;
+          break;
+        }
+    }
+    mean = c -> mean + g * ndim;
+    istd = c -> istd + g * ndim;
   }
-  return h;
+  for(int t = 0; t < nt; t ++)
+    for(int j = 0; j < ndim; j ++)
+      x[t * ndim + j] = (x[t * ndim + j] - mean[j]) * istd[j];
+  free(local);
 }
 
 static lrh_observ* load_observ_from_float(const char* path, lrh_model* h) {
-  FILE* fin = fopen(path, "rb");
-  if(fin == NULL) return NULL;
-  
   int ndim[64];
   int stride = 0;
   for(int l = 0; l < h -> nstream; l ++) {
     ndim[l] = h -> streams[l] -> gmms[0] -> ndim;
     stride += h -> streams[l] -> gmms[0] -> ndim;
   }
-  fseek(fin, 0, SEEK_END);
-  int fsize = ftell(fin);
-  fseek(fin, 0, SEEK_SET);
 
-  if(fsize % stride * 4 != 0) {
-    fprintf(stderr, "Error: file size of %s does not match with the model.\n", path);
-    fclose(fin);
+  int nt = 0;
+  float* fdata = read_feature_file(path, stride, & nt);
+  if(fdata == NULL) {
+    fprintf(stderr, "Error: cannot read %s or its size does not match with "
+      "the model.\n", path);
     return NULL;
   }
-  
-  int nt = fsize / stride / 4;
-  float* fdata = malloc(fsize);
-  fread(fdata, 4, fsize / 4, fin);
-  fclose(fin);
+  if(feature_cmvn != NULL) {
+    if(feature_cmvn -> ndim != stride) {
+      fprintf(stderr, "Error: dimension of the normalization statistics does "
+        "not match with the model.\n");
+      free(fdata);
+      return NULL;
+    }
+    apply_cmvn(feature_cmvn, path, fdata, nt);
+  }
 
   lrh_observ* o = lrh_create_observ(h -> nstream, nt, ndim);
   int c = 0;
@@ -99,12 +764,6 @@ static lrh_observ* load_observ_from_float(const char* path, lrh_model* h) {
   return o;
 }
 
-#define checkvar(name) \
-  if(j_##name == NULL) { \
-    fprintf(stderr, "Error: missing JSON attribute: \"%s\"\n", #name); \
-    exit(1); \
-  }
-
 static lrh_seg* load_seg_from_json(cJSON* j_states, int nstream) {
   int nseg = cJSON_GetArraySize(j_states);
   lrh_seg* s = lrh_create_seg(nstream, nseg);
@@ -317,6 +976,561 @@ static cJSON* json_from_seg_shuffle(lrh_seg* s, cJSON* j_states_in, int* shufidx
   return j_states;
 }
 
+// split str by delim; behaves like string.delimit in misc.lua
+static char** delimit(const char* str, char delim, int* n) {
+  int len = strlen(str);
+  char** ret = malloc((len + 1) * sizeof(char*));
+  *n = 0;
+  if(len == 0) return ret;
+  const char* last = str;
+  for(const char* p = str; ; p ++) {
+    if(*p == delim || *p == 0) {
+      ret[*n] = malloc(p - last + 1);
+      memcpy(ret[*n], last, p - last);
+      ret[*n][p - last] = 0;
+      (*n) ++;
+      last = p + 1;
+    }
+    if(*p == 0) break;
+  }
+  return ret;
+}
+
+static void free_tokens(char** tokens, int n) {
+  for(int i = 0; i < n; i ++) free(tokens[i]);
+  free(tokens);
+}
+
+static void checkpm(cJSON* j_pm) {
+  cJSON* j_phone_map = cJSON_GetObjectItem(j_pm, "phone_map");
+  checkvar(phone_map);
+  for(cJSON* j_p = j_phone_map -> child; j_p != NULL; j_p = j_p -> next) {
+    cJSON* j_states = cJSON_GetObjectItem(j_p, "states");
+    checkvar(states);
+    for(cJSON* j_st = j_states -> child; j_st != NULL; j_st = j_st -> next) {
+      cJSON* j_out = cJSON_GetObjectItem(j_st, "out");
+      checkvar(out);
+      cJSON* j_dur = cJSON_GetObjectItem(j_st, "dur");
+      checkvar(dur);
+    }
+  }
+}
+
+/*
+  Streaming reader for the file_list of a segmentation file. The document is
+    scanned character by character and each element of file_list is parsed on
+    its own, so memory use is bounded by the largest entry rather than the
+    whole corpus. Keys other than file_list at the top level are skipped.
+*/
+typedef struct {
+  FILE* fin;
+  int inlist;   // 0: before file_list, 1: inside, 2: after
+  int error;    // set if the document ends or fails to parse mid-way
+  char* buffer;
+  int capacity;
+} file_list_reader;
+
+static file_list_reader* open_file_list(const char* path) {
+  FILE* fin = fopen(path, "r");
+  if(fin == NULL) return NULL;
+  file_list_reader* ret = calloc(1, sizeof(file_list_reader));
+  ret -> fin = fin;
+  ret -> capacity = 4096;
+  ret -> buffer = malloc(ret -> capacity);
+  return ret;
+}
+
+static void close_file_list(file_list_reader* r) {
+  fclose(r -> fin);
+  free(r -> buffer);
+  free(r);
+}
+
+// reads a JSON string (the opening quote already consumed) into r -> buffer
+static int scan_json_string(file_list_reader* r, int* n, int store) {
+  int ch, escape = 0;
+  while((ch = getc(r -> fin)) != EOF) {
+    if(store) {
+      if(*n + 2 >= r -> capacity) {
+        r -> capacity *= 2;
+        r -> buffer = realloc(r -> buffer, r -> capacity);
+      }
+      r -> buffer[(*n) ++] = ch;
+    }
+    if(escape) escape = 0;
+    else if(ch == '\\') escape = 1;
+    else if(ch == '"') return 1;
+  }
+  return 0;
+}
+
+// the next entry of file_list, or NULL at its end or on error
+static cJSON* next_file_list_entry(file_list_reader* r) {
+  int ch, depth = 0, n = 0;
+  if(r -> inlist == 0) {
+    // find "file_list" at the top level, followed by [
+    int key_match = 0;
+    while((ch = getc(r -> fin)) != EOF) {
+      if(ch == '"') {
+        n = 0;
+        if(! scan_json_string(r, & n, depth == 1)) break;
+        if(depth == 1) {
+          r -> buffer[n] = 0;
+          key_match = ! strcmp(r -> buffer, "file_list\"");
+        }
+      } else if(ch == '{' || ch == '[') {
+        if(ch == '[' && depth == 1 && key_match) {
+          r -> inlist = 1;
+          break;
+        }
+        depth ++;
+      } else if(ch == '}' || ch == ']')
+        depth --;
+    }
+    if(r -> inlist == 0) {
+      r -> error = 1;
+      return NULL;
+    }
+  }
+  if(r -> inlist == 2) return NULL;
+
+  // skip to the next element
+  while((ch = getc(r -> fin)) != EOF)
+    if(ch == '{') break;
+    else if(ch == ']') {
+      r -> inlist = 2;
+      return NULL;
+    }
+  if(ch == EOF) {
+    r -> error = 1;
+    return NULL;
+  }
+
+  n = 0;
+  r -> buffer[n ++] = '{';
+  depth = 1;
+  while(depth > 0 && (ch = getc(r -> fin)) != EOF) {
+    if(n + 2 >= r -> capacity) {
+      r -> capacity *= 2;
+      r -> buffer = realloc(r -> buffer, r -> capacity);
+    }
+    r -> buffer[n ++] = ch;
+    if(ch == '"') {
+      if(! scan_json_string(r, & n, 1)) break;
+    } else if(ch == '{' || ch == '[')
+      depth ++;
+    else if(ch == '}' || ch == ']')
+      depth --;
+  }
+  if(depth > 0) {
+    r -> error = 1;
+    return NULL;
+  }
+  r -> buffer[n] = 0;
+  cJSON* ret = cJSON_Parse(r -> buffer);
+  if(ret == NULL) r -> error = 1;
+  return ret;
+}
+
+// copy frames [t0, t1) of an observation
+static lrh_observ* slice_observ(lrh_observ* o, int t0, int t1) {
+  lrh_observ* ret = lrh_create_observ(o -> nstream, t1 - t0, o -> ndim);
+  for(int l = 0; l < o -> nstream; l ++)
+    for(int t = t0; t < t1; t ++)
+      for(int n = 0; n < o -> ndim[l]; n ++)
+        lrh_obm(ret, t - t0, n, l) = lrh_obm(o, t, n, l);
+  return ret;
+}
+
+// copy states [i0, i1) of a segmentation, shifting the time by -t0;
+//   jumps leaving the range are merged into the forward transition
+static lrh_seg* slice_seg(lrh_seg* s, int i0, int i1, int t0) {
+  lrh_seg* ret = lrh_create_seg(s -> nstream, i1 - i0);
+  for(int i = i0; i < i1; i ++) {
+    int di = i - i0;
+    ret -> time[di] = s -> time[i] - t0;
+    ret -> durstate[di] = s -> durstate[i];
+    for(int l = 0; l < s -> nstream; l ++)
+      ret -> outstate[l][di] = s -> outstate[l][i];
+    int njmp = 0;
+    while(s -> djump_out[i][njmp] != 1) njmp ++;
+    ret -> djump_out[di] = realloc(ret -> djump_out[di], (njmp + 1) * sizeof(int));
+    ret -> pjump_out[di] = realloc(ret -> pjump_out[di],
+      (njmp + 1) * sizeof(FP_TYPE));
+    int njmp_valid = 0;
+    FP_TYPE pnext = 1.0;
+    for(int k = 0; k < njmp; k ++) {
+      int d = s -> djump_out[i][k];
+      if(i + d <= i1) {
+        ret -> djump_out[di][njmp_valid] = d;
+        ret -> pjump_out[di][njmp_valid] = s -> pjump_out[i][k];
+        pnext -= s -> pjump_out[i][k];
+        njmp_valid ++;
+      }
+    }
+    ret -> djump_out[di][njmp_valid] = 1;
+    ret -> pjump_out[di][njmp_valid] = pnext;
+  }
+  return ret;
+}
+
+// place the initial state boundaries over nt frames in proportion to the
+//   mean state durations of the model
+static void distribute_by_duration(lrh_model* h, lrh_seg* s, int nt) {
+  FP_TYPE total = 0;
+  for(int i = 0; i < s -> nseg; i ++)
+    total += h -> durations[s -> durstate[i]] -> mean;
+  FP_TYPE acc = 0;
+  for(int i = 0; i < s -> nseg; i ++) {
+    acc += h -> durations[s -> durstate[i]] -> mean;
+    s -> time[i] = total > 0 ? floor(acc / total * nt + 0.5) :
+      floor((i + 1.0) * nt / s -> nseg);
+  }
+  s -> time[s -> nseg - 1] = nt;
+}
+
+// convert the (time, state) list returned by lrh_viterbi into per-state end
+//   times; skipped states end at the same time as their predecessor
+static void endtime_from_realign(int* realign, int nseg, int* dst) {
+  int k = 0;
+  int prev = 0;
+  for(int i = 0; i < nseg; i ++) {
+    if(realign[k * 2] != -1 && realign[k * 2 + 1] == i) {
+      prev = realign[k * 2];
+      k ++;
+    }
+    dst[i] = prev;
+  }
+}
+
+// run Viterbi over the entire observation and store the end time of each
+//   state into dst; skipped states end at the same time as their predecessor
+// returns 0 if the search failed, in which case dst is filled with the input
+//   boundaries
+static int viterbi_endtime(lrh_model* h, lrh_observ* o, lrh_seg* s,
+  int geodur, int* dst) {
+  for(int i = 0; i < s -> nseg; i ++)
+    if(s -> time[i] > o -> nt)
+      s -> time[i] = o -> nt;
+  lrh_seg_buildjumps(s);
+  FP_TYPE* outp = NULL;
+  int* realign = NULL;
+  if(geodur) {
+    outp = lrh_sample_outputprob_lg_full(h, o, s);
+    realign = lrh_viterbi_geometric(h, s, outp, o -> nt, NULL);
+    if(realign != NULL)
+      for(int i = 0; i < s -> nseg; i ++)
+        dst[i] = realign[i];
+  } else {
+    outp = lrh_sample_outputprob_lg(h, o, s);
+    realign = lrh_viterbi(h, s, outp, o -> nt, NULL);
+    if(realign != NULL)
+      endtime_from_realign(realign, s -> nseg, dst);
+  }
+  int ok = realign != NULL;
+  if(! ok) // search failed; fall back to the initial boundaries
+    for(int i = 0; i < s -> nseg; i ++)
+      dst[i] = s -> time[i];
+  free(outp);
+  free(realign);
+  return ok;
+}
+
+// convert per-state end times into the (time, state) list used by
+//   json_from_seg_shuffle; zero-duration (skipped) states are dropped
+static int* shufidx_from_endtime(int* endtime, int nseg) {
+  int* ret = calloc(nseg * 2 + 2, sizeof(int));
+  int n = 0;
+  int prev = 0;
+  for(int i = 0; i < nseg; i ++) {
+    if(endtime[i] > prev) {
+      ret[n * 2 + 0] = endtime[i];
+      ret[n * 2 + 1] = i;
+      n ++;
+      prev = endtime[i];
+    }
+  }
+  ret[n * 2] = -1;
+  return ret;
+}
+
+/*
+  Parallel model operations. liblrhsmm walks the streams, output states and
+    duration states of a model one after another; since every state is
+    independent, the model and its statistics are cut into views of up to
+    MODEL_CHUNK states (shallow copies pointing into the original tables),
+    which are processed in parallel.
+*/
+
+#define MODEL_CHUNK 64
+
+typedef struct {
+  int stream;       // -1 for a chunk of duration states
+  int i0;
+  int i1;
+} model_chunk;
+
+static model_chunk* make_model_chunks(lrh_model* h, int* nchunk) {
+  int n = (h -> nduration + MODEL_CHUNK - 1) / MODEL_CHUNK;
+  for(int l = 0; l < h -> nstream; l ++)
+    n += (h -> streams[l] -> ngmm + MODEL_CHUNK - 1) / MODEL_CHUNK;
+  model_chunk* ret = malloc((n + 1) * sizeof(model_chunk));
+  n = 0;
+  for(int l = 0; l < h -> nstream; l ++)
+    for(int i = 0; i < h -> streams[l] -> ngmm; i += MODEL_CHUNK) {
+      ret[n].stream = l;
+      ret[n].i0 = i;
+      ret[n].i1 = min(i + MODEL_CHUNK, h -> streams[l] -> ngmm);
+      n ++;
+    }
+  for(int i = 0; i < h -> nduration; i += MODEL_CHUNK) {
+    ret[n].stream = -1;
+    ret[n].i0 = i;
+    ret[n].i1 = min(i + MODEL_CHUNK, h -> nduration);
+    n ++;
+  }
+  *nchunk = n;
+  return ret;
+}
+
+typedef struct {
+  lrh_model h;
+  lrh_stream stream;
+  lrh_stream* pstream;
+} model_view;
+
+typedef struct {
+  lrh_model_stat s;
+  lrh_stream_stat stream;
+  lrh_stream_stat* pstream;
+} model_stat_view;
+
+static void init_model_view(model_view* dst, lrh_model* h, model_chunk c) {
+  dst -> h = *h;
+  if(c.stream < 0) {
+    dst -> h.nstream = 0;
+    dst -> h.nduration = c.i1 - c.i0;
+    dst -> h.durations = h -> durations + c.i0;
+  } else {
+    dst -> stream = *h -> streams[c.stream];
+    dst -> stream.ngmm = c.i1 - c.i0;
+    dst -> stream.gmms = h -> streams[c.stream] -> gmms + c.i0;
+    dst -> pstream = & dst -> stream;
+    dst -> h.nstream = 1;
+    dst -> h.streams = & dst -> pstream;
+    dst -> h.nduration = 0;
+  }
+}
+
+static void init_model_stat_view(model_stat_view* dst, lrh_model_stat* s,
+  model_chunk c) {
+  dst -> s = *s;
+  if(c.stream < 0) {
+    dst -> s.nstream = 0;
+    dst -> s.nduration = c.i1 - c.i0;
+    dst -> s.durations = s -> durations + c.i0;
+  } else {
+    dst -> stream = *s -> streams[c.stream];
+    dst -> stream.ngmm = c.i1 - c.i0;
+    dst -> stream.gmms = s -> streams[c.stream] -> gmms + c.i0;
+    dst -> pstream = & dst -> stream;
+    dst -> s.nstream = 1;
+    dst -> s.streams = & dst -> pstream;
+    dst -> s.nduration = 0;
+  }
+}
+
+static void model_precompute(lrh_model* h) {
+  int nchunk = 0;
+  model_chunk* chunks = make_model_chunks(h, & nchunk);
+# pragma omp parallel for schedule(dynamic)
+  for(int k = 0; k < nchunk; k ++) {
+    model_view v;
+    init_model_view(& v, h, chunks[k]);
+    lrh_model_precompute(& v.h);
+  }
+  free(chunks);
+}
+
+// the per-state statistics are created in parallel on views of h and moved
+//   into a single lrh_model_stat laid out as lrh_model_stat_from_model does
+static lrh_model_stat* model_stat_from_model(lrh_model* h) {
+  int nchunk = 0;
+  model_chunk* chunks = make_model_chunks(h, & nchunk);
+  if(nchunk == 0) {
+    free(chunks);
+    return lrh_model_stat_from_model(h);
+  }
+  lrh_model_stat** parts = calloc(nchunk, sizeof(lrh_model_stat*));
+# pragma omp parallel for schedule(dynamic)
+  for(int k = 0; k < nchunk; k ++) {
+    model_view v;
+    init_model_view(& v, h, chunks[k]);
+    parts[k] = lrh_model_stat_from_model(& v.h);
+  }
+
+  // streams without any gmm (and hence without any chunk) still get an empty
+  //   stream statistic so that lrh_delete_model_stat can free every stream
+  lrh_model_stat* ret = calloc(1, sizeof(lrh_model_stat));
+  ret -> nstream = h -> nstream;
+  ret -> nduration = h -> nduration;
+  ret -> streams = malloc(h -> nstream * sizeof(lrh_stream_stat*));
+  ret -> durations = malloc(h -> nduration * sizeof(lrh_duration_stat*));
+  for(int l = 0; l < h -> nstream; l ++) {
+    int ngmm = h -> streams[l] -> ngmm;
+    ret -> streams[l] = calloc(1, sizeof(lrh_stream_stat));
+    ret -> streams[l] -> ngmm = ngmm;
+    ret -> streams[l] -> gmms = malloc(max(1, ngmm) * sizeof(lrh_gmm_stat*));
+  }
+  for(int k = 0; k < nchunk; k ++) {
+    model_chunk c = chunks[k];
+    lrh_model_stat* part = parts[k];
+    if(c.stream < 0) {
+      for(int i = c.i0; i < c.i1; i ++)
+        ret -> durations[i] = part -> durations[i - c.i0];
+    } else {
+      for(int i = c.i0; i < c.i1; i ++)
+        ret -> streams[c.stream] -> gmms[i] =
+          part -> streams[0] -> gmms[i - c.i0];
+      free(part -> streams[0] -> gmms);
+      free(part -> streams[0]);
+    }
+    free(part -> streams);
+    free(part -> durations);
+    free(part);
+  }
+  free(parts);
+  free(chunks);
+  return ret;
+}
+
+static void model_update(lrh_model* h, lrh_model_stat* s, int fixdur) {
+  int nchunk = 0;
+  model_chunk* chunks = make_model_chunks(h, & nchunk);
+# pragma omp parallel for schedule(dynamic)
+  for(int k = 0; k < nchunk; k ++) {
+    model_view v;
+    model_stat_view vs;
+    init_model_view(& v, h, chunks[k]);
+    init_model_stat_view(& vs, s, chunks[k]);
+    lrh_model_update(& v.h, & vs.s, fixdur);
+  }
+  free(chunks);
+}
+
+/*
+  Pruning margins. The HSMM search at frame t only visits the states within
+    lrh_inference_stprune of the state assigned to t by the input segmentation,
+    and only extends each state by up to lrh_inference_duration_extra frames
+    beyond its input duration. Comparing the best path against the input
+    segmentation tells how much of that search space was actually needed;
+    a path touching the limit may have been cut off by the pruning. A failed
+    search (no path within the pruned space at all) leaves nothing to measure;
+    such files are counted separately and rule out any tighter suggestion.
+*/
+
+typedef struct {
+  int nt;
+  int nseg;
+  int max_offset;   // max. |aligned state - input state| over all frames
+  double mean_offset;
+  int max_excess;   // max. (aligned duration - input duration) over states
+  int nfail;        // failed searches; the fields above are unknown if > 0
+} prune_stat;
+
+typedef struct {
+  int nfile;
+  int nlimit;       // files whose path touched the pruning limit
+  int nfailfile;    // files with at least one failed search
+  int nfail;
+  int max_offset;
+  int max_excess;
+  double sum_offset;
+  long nt;
+} prune_summary;
+
+static prune_stat get_prune_stat(lrh_seg* s, int* endtime, int nt,
+  int nfail) {
+  prune_stat ret = {nt, s -> nseg, 0, 0, 0, nfail};
+  if(nfail > 0) return ret;
+  int i0 = 0;
+  int a = 0;
+  double sum = 0;
+  for(int t = 0; t < nt; t ++) {
+    while(i0 < s -> nseg - 1 && s -> time[i0] <= t) i0 ++;
+    while(a < s -> nseg - 1 && endtime[a] <= t) a ++;
+    int offset = abs(a - i0);
+    ret.max_offset = max(ret.max_offset, offset);
+    sum += offset;
+  }
+  ret.mean_offset = nt > 0 ? sum / nt : 0;
+  for(int i = 0; i < s -> nseg; i ++) {
+    int d = endtime[i] - (i == 0 ? 0 : endtime[i - 1]);
+    int d0 = min(s -> time[i], nt) - (i == 0 ? 0 : min(s -> time[i - 1], nt));
+    ret.max_excess = max(ret.max_excess, d - d0);
+  }
+  return ret;
+}
+
+static int prune_at_limit(prune_stat st) {
+  return st.max_offset >= lrh_inference_stprune ||
+         st.max_excess >= lrh_inference_duration_extra;
+}
+
+static void print_prune_header(FILE* fout, const char* prefix) {
+  fprintf(fout, "%sfile,frames,states,max_state_offset,mean_state_offset,"
+    "state_margin,max_duration_excess,duration_margin,search_failures\n",
+    prefix);
+}
+
+static void print_prune_stat(FILE* fout, const char* prefix,
+  const char* filename, prune_stat st) {
+  if(st.nfail > 0) {
+    fprintf(fout, "%s%s,%d,%d,,,,,,%d\n", prefix, filename, st.nt, st.nseg,
+      st.nfail);
+    return;
+  }
+  fprintf(fout, "%s%s,%d,%d,%d,%.3f,%d,%d,%d,0\n", prefix, filename, st.nt,
+    st.nseg, st.max_offset, st.mean_offset,
+    lrh_inference_stprune - st.max_offset, st.max_excess,
+    lrh_inference_duration_extra - st.max_excess);
+}
+
+static void add_prune_stat(prune_summary* dst, prune_stat st) {
+  dst -> nfile ++;
+  if(st.nfail > 0) {
+    dst -> nfailfile ++;
+    dst -> nfail += st.nfail;
+    return;
+  }
+  dst -> nlimit += prune_at_limit(st);
+  dst -> max_offset = max(dst -> max_offset, st.max_offset);
+  dst -> max_excess = max(dst -> max_excess, st.max_excess);
+  dst -> sum_offset += st.mean_offset * st.nt;
+  dst -> nt += st.nt;
+}
+
+static void print_prune_summary(prune_summary* src) {
+  if(src -> nfile == 0) return;
+  if(src -> nfile > src -> nfailfile)
+    fprintf(stderr, "Pruning: max. state offset = %d (-p %d), "
+      "mean state offset = %.2f, max. duration excess = %d (-d %d).\n",
+      src -> max_offset, lrh_inference_stprune,
+      src -> nt > 0 ? src -> sum_offset / src -> nt : 0, src -> max_excess,
+      lrh_inference_duration_extra);
+  if(src -> nfailfile > 0)
+    fprintf(stderr, "Pruning: the search failed %d times in %d of %d files "
+      "(not included above); consider increasing -p/-d.\n", src -> nfail,
+      src -> nfailfile, src -> nfile);
+  else if(src -> nlimit > 0)
+    fprintf(stderr, "Pruning: the best path reached the search limit in "
+      "%d of %d files; consider increasing -p/-d.\n", src -> nlimit,
+      src -> nfile);
+  else
+    fprintf(stderr, "Pruning: tightest settings covering all files are "
+      "-p %d -d %d.\n", src -> max_offset + 1, src -> max_excess + 1);
+}
+
 static void delete_dataset(lrh_dataset* dst) {
   if(dst == NULL) return;
   lrh_delete_segset(dst -> segset);
@@ -324,3 +1538,223 @@ static void delete_dataset(lrh_dataset* dst) {
   free(dst);
 }
 
+
+/*
+  Profiling. Enabled by setting SHIRO_PROFILE to the path of the JSON summary;
+    SHIRO_TRACE additionally writes every recorded phase in Chrome trace-event
+    format (chrome://tracing). Both files are written at exit.
+  CPU time is measured for the whole process, so it is only recorded for
+    phases outside parallel regions; for a phase spanning a parallel loop the
+    ratio between CPU and wall time shows the effective parallelism.
+*/
+
+typedef struct {
+  const char* name;
+  int file;
+  int iter;
+  int thread;
+  double start;
+  double wall;
+  double cpu;
+  long frames;
+  long segments;      // states in the input segmentation, not after pruning
+} prof_event;
+
+typedef struct {
+  double wall;
+  double cpu;
+} prof_stamp;
+
+static int prof_enabled = 0;
+static int prof_iteration = -1;
+static const char* prof_tool = NULL;
+static const char* prof_path = NULL;
+static const char* prof_trace_path = NULL;
+static prof_event* prof_events = NULL;
+static int prof_nevent = 0;
+static int prof_capacity = 0;
+static double prof_epoch = 0;
+static double prof_cpu_epoch = 0;
+
+static double prof_wall_time() {
+# ifdef _OPENMP
+  return omp_get_wtime();
+# else
+  return (double)time(NULL);
+# endif
+}
+
+static double prof_cpu_time() {
+# ifdef _WIN32
+  return (double)clock() / CLOCKS_PER_SEC;
+# else
+  struct rusage u;
+  getrusage(RUSAGE_SELF, & u);
+  return u.ru_utime.tv_sec + u.ru_utime.tv_usec * 1e-6 +
+         u.ru_stime.tv_sec + u.ru_stime.tv_usec * 1e-6;
+# endif
+}
+
+static long prof_peak_rss() {
+# ifdef _WIN32
+  return -1;
+# else
+  struct rusage u;
+  getrusage(RUSAGE_SELF, & u);
+  return u.ru_maxrss; // kB on Linux
+# endif
+}
+
+static int prof_thread() {
+# ifdef _OPENMP
+  return omp_get_thread_num();
+# else
+  return 0;
+# endif
+}
+
+static int prof_in_parallel() {
+# ifdef _OPENMP
+  return omp_in_parallel();
+# else
+  return 0;
+# endif
+}
+
+static prof_stamp prof_start() {
+  prof_stamp ret = {0, 0};
+  if(! prof_enabled) return ret;
+  ret.wall = prof_wall_time();
+  if(! prof_in_parallel())
+    ret.cpu = prof_cpu_time();
+  return ret;
+}
+
+static void prof_stop(prof_stamp start, const char* name, int file,
+  long frames, long segments) {
+  if(! prof_enabled) return;
+  prof_event e;
+  e.name = name;
+  e.file = file;
+  e.iter = prof_iteration;
+  e.thread = prof_thread();
+  e.start = start.wall - prof_epoch;
+  e.wall = prof_wall_time() - start.wall;
+  e.cpu = prof_in_parallel() ? -1 : prof_cpu_time() - start.cpu;
+  e.frames = frames;
+  e.segments = segments;
+# pragma omp critical(profiler)
+  {
+    if(prof_nevent == prof_capacity) {
+      prof_capacity = prof_capacity == 0 ? 1024 : prof_capacity * 2;
+      prof_events = realloc(prof_events, prof_capacity * sizeof(prof_event));
+    }
+    prof_events[prof_nevent ++] = e;
+  }
+}
+
+static void prof_write_summary(FILE* fout, double total_wall, double total_cpu) {
+  // aggregate by phase name, in order of first appearance
+  int nphase = 0;
+  int* first = malloc((prof_nevent + 1) * sizeof(int));
+  for(int i = 0; i < prof_nevent; i ++) {
+    int found = 0;
+    for(int j = 0; j < nphase && ! found; j ++)
+      found = strcmp(prof_events[first[j]].name, prof_events[i].name) == 0;
+    if(! found) first[nphase ++] = i;
+  }
+
+  fprintf(fout, "{\n  \"tool\": \"%s\",\n", prof_tool);
+  fprintf(fout, "  \"wall_time\": %.6f,\n  \"cpu_time\": %.6f,\n",
+    total_wall, total_cpu);
+  fprintf(fout, "  \"peak_rss_kb\": %ld,\n", prof_peak_rss());
+  fprintf(fout, "  \"phases\": [");
+  for(int j = 0; j < nphase; j ++) {
+    const char* name = prof_events[first[j]].name;
+    int count = 0;
+    double wall = 0, cpu = 0;
+    long frames = 0, segments = 0;
+    for(int i = first[j]; i < prof_nevent; i ++) {
+      prof_event* e = & prof_events[i];
+      if(strcmp(e -> name, name) != 0) continue;
+      count ++;
+      wall += e -> wall;
+      if(e -> cpu >= 0) cpu += e -> cpu;
+      frames += e -> frames;
+      segments += e -> segments;
+    }
+    fprintf(fout, "%s\n    {\"name\": \"%s\", \"count\": %d, "
+      "\"wall\": %.6f, \"cpu\": %.6f, \"frames\": %ld, \"segments\": %ld, "
+      "\"frames_per_second\": %.1f}", j == 0 ? "" : ",", name, count, wall,
+      cpu, frames, segments, wall > 0 ? frames / wall : 0);
+  }
+  fprintf(fout, "\n  ],\n  \"events\": [");
+  for(int i = 0; i < prof_nevent; i ++) {
+    prof_event* e = & prof_events[i];
+    fprintf(fout, "%s\n    {\"name\": \"%s\", \"file\": %d, "
+      "\"iteration\": %d, \"thread\": %d, \"start\": %.6f, "
+      "\"wall\": %.6f, ", i == 0 ? "" : ",", e -> name, e -> file,
+      e -> iter, e -> thread, e -> start, e -> wall);
+    if(e -> cpu >= 0)
+      fprintf(fout, "\"cpu\": %.6f, ", e -> cpu);
+    else
+      fprintf(fout, "\"cpu\": null, ");
+    fprintf(fout, "\"frames\": %ld, \"segments\": %ld}", e -> frames,
+      e -> segments);
+  }
+  fprintf(fout, "\n  ]\n}\n");
+  free(first);
+}
+
+static void prof_write_trace(FILE* fout) {
+  fprintf(fout, "{\"traceEvents\": [");
+  for(int i = 0; i < prof_nevent; i ++) {
+    prof_event* e = & prof_events[i];
+    fprintf(fout, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", "
+      "\"ts\": %.1f, \"dur\": %.1f, \"pid\": 0, \"tid\": %d, "
+      "\"args\": {\"file\": %d, \"iteration\": %d, \"frames\": %ld, "
+      "\"segments\": %ld}}", i == 0 ? "" : ",", e -> name, e -> start * 1e6,
+      e -> wall * 1e6, e -> thread, e -> file, e -> iter, e -> frames,
+      e -> segments);
+  }
+  fprintf(fout, "\n]}\n");
+}
+
+static void prof_finish() {
+  if(! prof_enabled) return;
+  prof_enabled = 0;
+  double total_wall = prof_wall_time() - prof_epoch;
+  double total_cpu = prof_cpu_time() - prof_cpu_epoch;
+  FILE* fout = fopen(prof_path, "w");
+  if(fout == NULL) {
+    fprintf(stderr, "Warning: cannot create %s.\n", prof_path);
+  } else {
+    prof_write_summary(fout, total_wall, total_cpu);
+    fclose(fout);
+  }
+  if(prof_trace_path != NULL) {
+    fout = fopen(prof_trace_path, "w");
+    if(fout == NULL) {
+      fprintf(stderr, "Warning: cannot create %s.\n", prof_trace_path);
+    } else {
+      prof_write_trace(fout);
+      fclose(fout);
+    }
+  }
+  free(prof_events);
+  prof_events = NULL;
+  prof_nevent = prof_capacity = 0;
+}
+
+static void prof_init(const char* tool) {
+  prof_path = getenv("SHIRO_PROFILE");
+  if(prof_path == NULL || prof_path[0] == 0) return;
+  prof_trace_path = getenv("SHIRO_TRACE");
+  if(prof_trace_path != NULL && prof_trace_path[0] == 0)
+    prof_trace_path = NULL;
+  prof_tool = tool;
+  prof_enabled = 1;
+  prof_epoch = prof_wall_time();
+  prof_cpu_epoch = prof_cpu_time();
+  atexit(prof_finish);
+}
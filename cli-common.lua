@@ -169,7 +169,36 @@ local function parse_lab(str)
   return ret
 end
 
+-- number of frames in an open feature file, either headerless 32-bit float
+--   or compact (see feature-io.h); nil if the size does not match ndim
+function feature_nframe(fh, ndim)
+  local size = fh:seek("end")
+  fh:seek("set", 0)
+  local header = fh:read(16)
+  fh:seek("set", 0)
+  local value_size = 4
+  if header ~= nil and #header == 16 and header:sub(1, 4) == "SHR\255" then
+    local encoding = header:byte(5)
+    local hdim = header:byte(9) + header:byte(10) * 256 +
+      header:byte(11) * 65536 + header:byte(12) * 16777216
+    if hdim ~= ndim then return nil end
+    size = size - 16
+    if encoding == 1 then
+      value_size = 2
+    elseif encoding == 2 then
+      value_size = 1
+      size = size - ndim * 8
+    else
+      return nil
+    end
+  end
+  local nfrm = size / value_size / ndim
+  if nfrm ~= math.floor(nfrm) or nfrm < 0 then return nil end
+  return nfrm
+end
+
 return {checkpm = checkpm,
   checkseg = checkseg,
   load_index_file = load_index_file,
-  parse_lab = parse_lab}
+  parse_lab = parse_lab,
+  feature_nframe = feature_nframe}
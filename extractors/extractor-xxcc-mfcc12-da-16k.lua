@@ -1,5 +1,15 @@
-return function (try_excute, path, rawfile, mypath)
-  local paramfile = path .. ".param"
-  try_execute(mypath .. "shiro-xxcc -l 512 -p 80 -m 12 -s 16 -da \"" ..
-    rawfile .. "\" > \"" .. paramfile .. "\"")
-end
+local options = "-l 512 -p 80 -m 12 -s 16 -da"
+
+return {
+  extract = function (try_execute, path, rawfile, mypath)
+    local paramfile = path .. ".param"
+    try_execute(mypath .. "shiro-xxcc " .. options .. " \"" ..
+      rawfile .. "\" > \"" .. paramfile .. "\"")
+  end,
+  -- one shiro-xxcc for a list of .raw files; each .param is written next to
+  --   its .raw
+  batch = function (try_execute, rawfiles, mypath)
+    try_execute(mypath .. "shiro-xxcc " .. options .. " -o .param \"" ..
+      table.concat(rawfiles, "\" \"") .. "\"")
+  end
+}
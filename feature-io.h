@@ -0,0 +1,244 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2017-2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHIRO_FEATURE_IO_H
+#define SHIRO_FEATURE_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+  Feature files. A plain feature file is a headerless array of 32-bit floats
+    (frame-major), as produced by SPTK. Compact files start with a 16-byte
+    header,
+      magic "SHR\xff" (a NaN when read as a float), encoding, 3 reserved
+      bytes, number of dimensions (uint32), 4 reserved bytes,
+    followed by
+      FEATURE_F16: IEEE 754 half precision values;
+      FEATURE_I8: per-dimension offset and scale (2 x ndim floats), then one
+        signed byte per value, x = offset + scale * q.
+*/
+
+#define FEATURE_MAGIC "SHR\xff"
+#define FEATURE_HEADER_SIZE 16
+#define FEATURE_F32 0
+#define FEATURE_F16 1
+#define FEATURE_I8  2
+
+typedef struct {
+  int encoding;
+  int ndim;       // 0 if unknown (headerless)
+  long offset;    // start of the values, including the I8 scale table
+  int value_size;
+} feature_format;
+
+static uint16_t float_to_half(float x) {
+  uint32_t f;
+  memcpy(& f, & x, 4);
+  uint32_t sign = (f >> 16) & 0x8000;
+  int32_t exponent = ((f >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = f & 0x7fffff;
+  if(((f >> 23) & 0xff) == 0xff) // inf or nan
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  if(exponent >= 31) return sign | 0x7c00;
+  if(exponent <= 0) { // subnormal or zero
+    if(exponent < -10) return sign;
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t mid = 1u << (shift - 1);
+    if(rest > mid || (rest == mid && (half & 1))) half ++;
+    return sign | half;
+  }
+  uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) half ++;
+  return half;
+}
+
+static float half_to_float(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t f;
+  if(exponent == 0x1f)
+    f = sign | 0x7f800000 | (mantissa << 13);
+  else if(exponent != 0)
+    f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  else if(mantissa == 0)
+    f = sign;
+  else { // subnormal half becomes a normal float
+    exponent = 127 - 15 + 1;
+    while(! (mantissa & 0x400)) {
+      mantissa <<= 1;
+      exponent --;
+    }
+    f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  float ret;
+  memcpy(& ret, & f, 4);
+  return ret;
+}
+
+static int parse_feature_encoding(const char* name) {
+  if(! strcmp(name, "f32")) return FEATURE_F32;
+  if(! strcmp(name, "f16")) return FEATURE_F16;
+  if(! strcmp(name, "i8")) return FEATURE_I8;
+  return -1;
+}
+
+// x: nfrm x ndim floats, frame-major
+static void write_feature_data(FILE* fout, float* x, int nfrm, int ndim,
+  int encoding) {
+  long n = (long)nfrm * ndim;
+  if(encoding == FEATURE_F32) {
+    fwrite(x, 4, n, fout);
+    return;
+  }
+  uint8_t header[FEATURE_HEADER_SIZE] = {0};
+  uint32_t ndim32 = ndim;
+  memcpy(header, FEATURE_MAGIC, 4);
+  header[4] = encoding;
+  memcpy(header + 8, & ndim32, 4);
+  fwrite(header, 1, FEATURE_HEADER_SIZE, fout);
+  if(encoding == FEATURE_F16) {
+    uint16_t* h = malloc(n * sizeof(uint16_t));
+    for(long i = 0; i < n; i ++) h[i] = float_to_half(x[i]);
+    fwrite(h, 2, n, fout);
+    free(h);
+  } else {
+    float* table = calloc(ndim * 2, sizeof(float));
+    for(int j = 0; j < ndim; j ++) {
+      float lo = nfrm > 0 ? x[j] : 0;
+      float hi = lo;
+      for(int t = 1; t < nfrm; t ++) {
+        float v = x[(long)t * ndim + j];
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+      }
+      table[j] = (hi + lo) * 0.5;
+      table[ndim + j] = hi > lo ? (hi - lo) / 254.0 : 1.0;
+    }
+    int8_t* q = malloc(n);
+    for(long i = 0; i < n; i ++) {
+      int j = i % ndim;
+      float v = (x[i] - table[j]) / table[ndim + j];
+      v = v < -127 ? -127 : (v > 127 ? 127 : v);
+      q[i] = (int8_t)(v < 0 ? v - 0.5 : v + 0.5);
+    }
+    fwrite(table, 4, ndim * 2, fout);
+    fwrite(q, 1, n, fout);
+    free(q);
+    free(table);
+  }
+}
+
+static int read_feature_format(FILE* fin, feature_format* dst) {
+  uint8_t header[FEATURE_HEADER_SIZE];
+  dst -> encoding = FEATURE_F32;
+  dst -> ndim = 0;
+  dst -> offset = 0;
+  dst -> value_size = 4;
+  size_t n = fread(header, 1, FEATURE_HEADER_SIZE, fin);
+  fseek(fin, 0, SEEK_SET);
+  if(n < FEATURE_HEADER_SIZE || memcmp(header, FEATURE_MAGIC, 4))
+    return 1;
+  uint32_t ndim32;
+  memcpy(& ndim32, header + 8, 4);
+  dst -> encoding = header[4];
+  dst -> ndim = ndim32;
+  dst -> offset = FEATURE_HEADER_SIZE;
+  if(dst -> encoding == FEATURE_F16)
+    dst -> value_size = 2;
+  else if(dst -> encoding == FEATURE_I8) {
+    dst -> value_size = 1;
+    dst -> offset += dst -> ndim * 2 * 4;
+  } else
+    return 0;
+  return 1;
+}
+
+// number of frames in a feature file of the given frame size; -1 if the
+//   file cannot be accessed, -2 if the size or dimension does not match
+static long feature_file_nframe(const char* path, int stride) {
+  FILE* fin = fopen(path, "rb");
+  if(fin == NULL) return -1;
+  feature_format fmt;
+  int valid = read_feature_format(fin, & fmt);
+  fseek(fin, 0, SEEK_END);
+  long size = ftell(fin) - fmt.offset;
+  fclose(fin);
+  if(! valid || (fmt.ndim != 0 && fmt.ndim != stride) || size < 0)
+    return -2;
+  if(size % ((long)stride * fmt.value_size) != 0) return -2;
+  return size / stride / fmt.value_size;
+}
+
+// read and decode a feature file into nt x stride floats
+static float* read_feature_file(const char* path, int stride, int* nt) {
+  FILE* fin = fopen(path, "rb");
+  if(fin == NULL) return NULL;
+  feature_format fmt;
+  int valid = read_feature_format(fin, & fmt);
+  fseek(fin, 0, SEEK_END);
+  long size = ftell(fin) - fmt.offset;
+  if(! valid || (fmt.ndim != 0 && fmt.ndim != stride) || size < 0 ||
+     size % ((long)stride * fmt.value_size) != 0) {
+    fclose(fin);
+    return NULL;
+  }
+  long n = size / fmt.value_size;
+  *nt = n / stride;
+  float* ret = malloc((n + 1) * sizeof(float));
+  if(fmt.encoding == FEATURE_F32) {
+    fseek(fin, fmt.offset, SEEK_SET);
+    fread(ret, 4, n, fin);
+  } else if(fmt.encoding == FEATURE_F16) {
+    uint16_t* h = malloc((n + 1) * sizeof(uint16_t));
+    fseek(fin, fmt.offset, SEEK_SET);
+    fread(h, 2, n, fin);
+    for(long i = 0; i < n; i ++) ret[i] = half_to_float(h[i]);
+    free(h);
+  } else {
+    float* table = malloc(stride * 2 * sizeof(float));
+    int8_t* q = malloc(n + 1);
+    fseek(fin, FEATURE_HEADER_SIZE, SEEK_SET);
+    fread(table, 4, stride * 2, fin);
+    fread(q, 1, n, fin);
+    float* offset = table;
+    float* scale = table + stride;
+    for(long t = 0; t < *nt; t ++) {
+      float* dst = ret + t * stride;
+      int8_t* src = q + t * stride;
+      for(int j = 0; j < stride; j ++)
+        dst[j] = offset[j] + scale[j] * src[j];
+    }
+    free(q);
+    free(table);
+  }
+  fclose(fin);
+  return ret;
+}
+
+#endif
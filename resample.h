@@ -0,0 +1,144 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2017-2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHIRO_RESAMPLE_H
+#define SHIRO_RESAMPLE_H
+
+#include <math.h>
+#include <stdlib.h>
+
+/*
+  Polyphase rational resampler. The output rate is fs_in * up / down with
+    up/down reduced by their gcd, e.g. 48k -> 16k is 1/3, 44.1k -> 16k is
+    160/441 and 22.05k -> 16k is 320/441. The anti-aliasing filter is a
+    Kaiser-windowed sinc, tabulated once for each of the up phases so that
+    every output sample is a single dot product over contiguous input.
+*/
+
+#define RESAMPLE_MAX_PHASE 4096
+
+typedef struct {
+  int up;
+  int down;
+  int ntap;      // taps per phase
+  int half;      // number of taps on the past side, including the current one
+  FP_TYPE* h;    // up x ntap, time-reversed
+} resampler;
+
+static int resample_gcd(int a, int b) {
+  while(b != 0) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+static double resample_bessel_i0(double x) {
+  double sum = 1, term = 1;
+  for(int k = 1; k < 64; k ++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if(term < sum * 1e-12) break;
+  }
+  return sum;
+}
+
+// nzero: zero crossings of the sinc on each side, at the lower of the two
+//   rates; rolloff: cutoff relative to the lower Nyquist frequency
+static resampler* create_resampler(int fs_in, int fs_out, int nzero,
+  FP_TYPE rolloff, FP_TYPE beta) {
+  int g = resample_gcd(fs_in, fs_out);
+  int up = fs_out / g;
+  int down = fs_in / g;
+  if(up > RESAMPLE_MAX_PHASE) return NULL;
+  resampler* ret = malloc(sizeof(resampler));
+  ret -> up = up;
+  ret -> down = down;
+  // cutoff in cycles per input sample x 2
+  double fc = (up < down ? (double)up / down : 1.0) * rolloff;
+  double width = nzero / fc;
+  ret -> half = (int)ceil(width);
+  ret -> ntap = ret -> half * 2;
+  ret -> h = malloc(up * ret -> ntap * sizeof(FP_TYPE));
+  double norm = resample_bessel_i0(beta);
+  for(int p = 0; p < up; p ++)
+    for(int k = 0; k < ret -> ntap; k ++) {
+      double tau = (double)p / up + ret -> half - 1 - k;
+      double r = tau / width;
+      double v = 0;
+      if(fabs(r) < 1) {
+        double arg = 3.14159265358979 * fc * tau;
+        double sinc = fabs(arg) < 1e-9 ? 1.0 : sin(arg) / arg;
+        v = fc * sinc * resample_bessel_i0(beta * sqrt(1 - r * r)) / norm;
+      }
+      ret -> h[p * ret -> ntap + k] = v;
+    }
+  return ret;
+}
+
+static void delete_resampler(resampler* dst) {
+  free(dst -> h);
+  free(dst);
+}
+
+static int resample_length(resampler* rs, int nx) {
+  return (long)nx * rs -> up / rs -> down;
+}
+
+/*
+  y[n] = sum_k h[p][k] x[i + k - half + 1], where i + p / up = n * down / up.
+  The input is padded on both sides and processed in blocks of outputs, so
+    the inner loop never needs a bounds check.
+*/
+#define RESAMPLE_BLOCK 4096
+
+static FP_TYPE* resample(resampler* rs, FP_TYPE* x, int nx, int* ny) {
+  int ntap = rs -> ntap;
+  int pad = rs -> half;
+  *ny = resample_length(rs, nx);
+  FP_TYPE* y = calloc(*ny + 1, sizeof(FP_TYPE));
+  FP_TYPE* xp = calloc(nx + pad * 2 + 1, sizeof(FP_TYPE));
+  for(int i = 0; i < nx; i ++) xp[i + pad] = x[i];
+  for(int n0 = 0; n0 < *ny; n0 += RESAMPLE_BLOCK) {
+    int n1 = n0 + RESAMPLE_BLOCK < *ny ? n0 + RESAMPLE_BLOCK : *ny;
+    long pos = (long)n0 * rs -> down;
+    long i = pos / rs -> up;
+    int p = pos % rs -> up;
+    for(int n = n0; n < n1; n ++) {
+      const FP_TYPE* hp = rs -> h + p * ntap;
+      const FP_TYPE* xi = xp + i + 1; // x[i - half + 1] after padding
+      FP_TYPE acc = 0;
+#     pragma omp simd reduction(+:acc)
+      for(int k = 0; k < ntap; k ++)
+        acc += hp[k] * xi[k];
+      y[n] = acc;
+      p += rs -> down;
+      i += p / rs -> up;
+      p %= rs -> up;
+    }
+  }
+  free(xp);
+  return y;
+}
+
+#endif
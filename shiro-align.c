@@ -27,10 +27,16 @@
 #include "external/liblrhsmm/common.h"
 #include "external/liblrhsmm/inference.h"
 #include "external/liblrhsmm/serial.h"
+#include <omp.h>
+#include <signal.h>
 
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#include <direct.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
 #endif
 
 #include "cli-common.h"
@@ -45,12 +51,631 @@ static void print_usage() {
     "  -P state-level-pruning (HMM)\n"
     "  -d extra-duration-search-space\n"
     "  -i (isolated alignment)\n"
+    "  -c decimation-factor (coarse-to-fine alignment)\n"
+    "  -b refinement-chunk-size (coarse-to-fine alignment, in states)\n"
+    "  -L anchor-interval (long-form alignment, in frames)\n"
+    "  -S (server mode, reading jobs from stdin)\n"
+    "  -u socket-path (server mode, listening on a unix domain socket)\n"
+    "  -T (enable multi-threading)\n"
+    "  -O (online alignment of frames streamed through stdin)\n"
+    "  -w update-interval (online alignment, in frames)\n"
+    "  -W maximum-window-size (online alignment, in frames)\n"
+    "  -R export-pruning-statistics-file\n"
+    "  -G num-clusters (Gaussian selection, with -g)\n"
+    "  -K shortlist-size (Gaussian selection, default 4)\n"
+    "  -V (compare Gaussian selection against exact evaluation)\n"
+    "  -x cache-directory (incremental alignment)\n"
+    "  -C num-files (calibrate -p and -d on a random sample)\n"
+    "  -A target-boundary-agreement (calibration, default 0.98)\n"
+    "  -N normalization-statistics-file (from shiro-cmvn)\n"
     "  -h (print usage)\n");
   exit(1);
 }
 
 int opt_geodur = 0;
 int opt_embdalign = 1;
+int opt_server = 0;
+int opt_mthread = 0;
+char* opt_socket = NULL;
+int opt_online = 0;
+int opt_interval = 20;
+int opt_maxwindow = 3000;
+int opt_decimation = 0;
+int opt_chunksize = 8;
+int opt_longchunk = 0;
+int opt_calibrate = 0;
+double opt_agreement = 0.98;
+lrh_model* hsmm_coarse = NULL;
+FILE* fp_prune = NULL;
+prune_stat last_prune;
+int last_prune_valid = 0;
+int prof_file = -1; // file index for phases nested in align()
+# pragma omp threadprivate(prof_file)
+int search_failures = 0;  // failed searches in the current file
+
+static void record_prune_stat(lrh_seg* s, int* endtime, int nt, int nfail) {
+  if(fp_prune == NULL) return;
+  last_prune = get_prune_stat(s, endtime, nt, nfail);
+  last_prune_valid = 1;
+}
+
+/*
+  Coarse-to-fine alignment: a geometric-duration pass over block-averaged
+    features gives approximate boundaries at a fraction of the cost, which
+    are then refined at the full frame rate by aligning small chunks of
+    states, each within the span given by the coarse boundaries around it.
+    A second refinement pass with chunks shifted by half a chunk frees the
+    boundaries that were held fixed in the first pass.
+*/
+
+// a model sharing the output distributions of h but with state durations
+//   shrunk by the decimation factor
+static lrh_model* create_coarse_model(lrh_model* h, int factor) {
+  lrh_model* ret = malloc(sizeof(lrh_model));
+  *ret = *h;
+  ret -> durations = malloc(h -> nduration * sizeof(lrh_duration*));
+  for(int i = 0; i < h -> nduration; i ++) {
+    ret -> durations[i] = lrh_create_duration();
+    ret -> durations[i] -> mean  = h -> durations[i] -> mean / factor;
+    ret -> durations[i] -> var   = h -> durations[i] -> var / factor / factor;
+    ret -> durations[i] -> floor = h -> durations[i] -> floor / factor;
+    ret -> durations[i] -> ceil  = h -> durations[i] -> ceil / factor;
+  }
+  lrh_model_precompute(ret);
+  return ret;
+}
+
+static void delete_coarse_model(lrh_model* dst) {
+  for(int i = 0; i < dst -> nduration; i ++)
+    lrh_delete_duration(dst -> durations[i]);
+  free(dst -> durations);
+  free(dst);
+}
+
+static lrh_observ* decimate_observ(lrh_observ* o, int factor) {
+  int nt = (o -> nt + factor - 1) / factor;
+  lrh_observ* ret = lrh_create_observ(o -> nstream, nt, o -> ndim);
+  for(int l = 0; l < o -> nstream; l ++)
+    for(int t = 0; t < nt; t ++) {
+      int t0 = t * factor;
+      int t1 = min(t0 + factor, o -> nt);
+      for(int n = 0; n < o -> ndim[l]; n ++) {
+        FP_TYPE sum = 0;
+        for(int k = t0; k < t1; k ++)
+          sum += lrh_obm(o, k, n, l);
+        lrh_obm(ret, t, n, l) = sum / (t1 - t0);
+      }
+    }
+  return ret;
+}
+
+// align each span of states [span[2c], span[2c + 1]) within the frames
+//   between its first and last boundary, which are kept fixed; spans must not
+//   overlap and are processed in parallel
+static void align_spans(lrh_model* hsmm, lrh_observ* o, lrh_seg* s,
+  int* endtime, int* span, int nspan) {
+# pragma omp parallel for schedule(dynamic)
+  for(int c = 0; c < nspan; c ++) {
+    int i0 = span[c * 2 + 0];
+    int i1 = span[c * 2 + 1];
+    int t0 = i0 == 0 ? 0 : endtime[i0 - 1];
+    int t1 = endtime[i1 - 1];
+    if(i1 - i0 < 2 || t1 - t0 < i1 - i0) continue;
+    lrh_observ* co = slice_observ(o, t0, t1);
+    lrh_seg* cs = slice_seg(s, i0, i1, t0);
+    for(int i = 0; i < cs -> nseg; i ++)
+      cs -> time[i] = endtime[i0 + i] - t0;
+    int* refined = calloc(i1 - i0, sizeof(int));
+    if(! viterbi_endtime(hsmm, co, cs, opt_geodur, refined)) {
+#     pragma omp atomic
+      search_failures ++;
+    }
+    for(int i = i0; i < i1 - 1; i ++)
+      endtime[i] = refined[i - i0] + t0;
+    free(refined);
+    lrh_delete_seg(cs);
+    lrh_delete_observ(co);
+  }
+}
+
+// refine in spans of opt_chunksize states, the first one being offset states
+static void refine_chunks(lrh_model* hsmm, lrh_observ* o, lrh_seg* s,
+  int* endtime, int offset) {
+  int* span = malloc((s -> nseg + 2) * 2 * sizeof(int));
+  int nspan = 0;
+  int i0 = 0;
+  int i1 = offset > 0 ? offset : opt_chunksize;
+  while(i0 < s -> nseg) {
+    i1 = min(i1, s -> nseg);
+    span[nspan * 2 + 0] = i0;
+    span[nspan * 2 + 1] = i1;
+    nspan ++;
+    i0 = i1;
+    i1 += opt_chunksize;
+  }
+  align_spans(hsmm, o, s, endtime, span, nspan);
+  free(span);
+}
+
+// geometric alignment on the features decimated from frame shift onwards
+static void coarse_endtime(lrh_observ* o, lrh_seg* s, int factor, int shift,
+  int* endtime) {
+  lrh_observ* so = slice_observ(o, shift, o -> nt);
+  lrh_observ* co = decimate_observ(so, factor);
+  lrh_seg* cs = slice_seg(s, 0, s -> nseg, 0);
+  for(int i = 0; i < cs -> nseg; i ++)
+    cs -> time[i] = max(0, min(co -> nt,
+      (cs -> time[i] - shift + factor / 2) / factor));
+  if(! viterbi_endtime(hsmm_coarse, co, cs, 1, endtime)) {
+#   pragma omp atomic
+    search_failures ++;
+  }
+  for(int i = 0; i < s -> nseg; i ++)
+    endtime[i] = min(o -> nt, endtime[i] * factor + shift);
+  endtime[s -> nseg - 1] = o -> nt;
+  lrh_delete_seg(cs);
+  lrh_delete_observ(co);
+  lrh_delete_observ(so);
+}
+
+static int* align_coarse_to_fine(lrh_model* hsmm, lrh_observ* o, lrh_seg* s) {
+  int* endtime = calloc(s -> nseg, sizeof(int));
+  coarse_endtime(o, s, opt_decimation, 0, endtime);
+  refine_chunks(hsmm, o, s, endtime, 0);
+  refine_chunks(hsmm, o, s, endtime, opt_chunksize / 2);
+  return endtime;
+}
+
+/*
+  Long-form alignment: the recording is scanned by a sliding coarse pass.
+    Each window of 2 * opt_longchunk frames, starting at the last anchor, is
+    decoded at two decimation phases with the states expected to cover it,
+    and the boundaries on which both agree become anchor candidates. Within
+    3/4 to 5/4 opt_longchunk frames into the window, the candidate next to
+    the longest state (typically a pause) is taken as the next anchor. The
+    utterance is split at the anchors into chunks that are aligned
+    independently at the full frame rate, after which each anchor is refined
+    together with a few states around it. No decoding buffer grows with the
+    length of the recording.
+*/
+
+// number of states needed to cover nt frames by their mean durations, plus a
+//   few states of lookahead
+static int online_lookahead(lrh_model* hsmm, lrh_seg* s, int i0, int nt) {
+  FP_TYPE acc = 0;
+  int i = i0;
+  while(i < s -> nseg && acc < nt) {
+    acc += hsmm -> durations[s -> durstate[i]] -> mean;
+    i ++;
+  }
+  return min(i + 3, s -> nseg);
+}
+
+// geometric alignment of states [i0, i1) to frames [t0, t1) decimated from
+//   frame t0 + shift onwards; dst receives the absolute end times
+static void coarse_window(lrh_observ* o, lrh_seg* s, int factor, int shift,
+  int i0, int i1, int t0, int t1, int* dst) {
+  lrh_observ* so = slice_observ(o, min(t0 + shift, t1 - 1), t1);
+  lrh_observ* co = decimate_observ(so, factor);
+  lrh_seg* cs = slice_seg(s, i0, i1, 0);
+  distribute_by_duration(hsmm_coarse, cs, co -> nt);
+  if(! viterbi_endtime(hsmm_coarse, co, cs, 1, dst)) {
+#   pragma omp atomic
+    search_failures ++;
+  }
+  for(int i = 0; i < i1 - i0; i ++)
+    dst[i] = min(t1, dst[i] * factor + t0 + shift);
+  dst[i1 - i0 - 1] = t1;
+  lrh_delete_seg(cs);
+  lrh_delete_observ(co);
+  lrh_delete_observ(so);
+}
+
+static int* align_long_form(lrh_model* hsmm, lrh_observ* o, lrh_seg* s) {
+  int nseg = s -> nseg;
+  int factor = opt_decimation > 1 ? opt_decimation : 4;
+  int nwin = opt_longchunk * 2;
+  int* endtime = calloc(nseg, sizeof(int));
+  int* endtime_a = calloc(nseg, sizeof(int));
+  int* endtime_b = calloc(nseg, sizeof(int));
+
+  // anchors are the last states of chunks
+  int* anchor = malloc(nseg * sizeof(int));
+  int nanchor = 0;
+  int tc = 0;     // end time of the last anchor
+  int sc = 0;     // first state after the last anchor
+  while(o -> nt - tc > nwin) {
+    // states expected within the window, with a margin for a faster speaker
+    int se = online_lookahead(hsmm, s, sc, nwin + nwin / 4);
+    if(se - sc < 4) break;
+    coarse_window(o, s, factor, 0, sc, se, tc, tc + nwin, endtime_a);
+    coarse_window(o, s, factor, factor / 2, sc, se, tc, tc + nwin, endtime_b);
+
+    // the last two states of the window are pinned by the forced end; fall
+    //   back to the last boundary in range if none of the candidates was
+    //   stable
+    int best = -1;
+    int best_dur = -1;
+    int last = -1;
+    for(int i = 0; i < se - sc - 2; i ++) {
+      int t = endtime_a[i];
+      if(t > tc + opt_longchunk * 5 / 4) break;
+      if(t > tc) last = i;
+      if(t < tc + opt_longchunk * 3 / 4) continue;
+      int stable = abs(endtime_b[i] - t) <= factor;
+      int dur = max(t - (i == 0 ? tc : endtime_a[i - 1]),
+        endtime_a[i + 1] - t);
+      if(stable && dur > best_dur) {
+        best = i;
+        best_dur = dur;
+      }
+    }
+    if(best < 0) best = last;
+    if(best < 0) break;
+    for(int i = 0; i <= best; i ++)
+      endtime[sc + i] = endtime_a[i];
+    anchor[nanchor ++] = sc + best;
+    tc = endtime_a[best];
+    sc += best + 1;
+    if(sc >= nseg - 1) break;
+  }
+  // the remaining states are spread over the remaining frames
+  if(sc < nseg) {
+    coarse_window(o, s, factor, 0, sc, nseg, tc, o -> nt, endtime_a);
+    for(int i = sc; i < nseg; i ++)
+      endtime[i] = endtime_a[i - sc];
+  }
+  fprintf(stderr, "Long-form alignment: %d anchors.\n", nanchor);
+
+  int* span = malloc((nanchor + 1) * 2 * sizeof(int));
+  for(int c = 0; c <= nanchor; c ++) {
+    span[c * 2 + 0] = c == 0 ? 0 : anchor[c - 1] + 1;
+    span[c * 2 + 1] = c == nanchor ? nseg : anchor[c] + 1;
+  }
+  align_spans(hsmm, o, s, endtime, span, nanchor + 1);
+
+  int nlocal = 0;
+  for(int c = 0; c < nanchor; c ++) {
+    int i0 = max(anchor[c] + 1 - opt_chunksize / 2,
+      nlocal == 0 ? 0 : span[nlocal * 2 - 1]);
+    int i1 = min(anchor[c] + 1 + opt_chunksize / 2, nseg);
+    if(i1 - i0 < 2) continue;
+    span[nlocal * 2 + 0] = i0;
+    span[nlocal * 2 + 1] = i1;
+    nlocal ++;
+  }
+  align_spans(hsmm, o, s, endtime, span, nlocal);
+
+  free(span);
+  free(anchor);
+  free(endtime_a);
+  free(endtime_b);
+  return endtime;
+}
+
+/*
+  Gaussian selection for multi-mixture output distributions. The mixture
+    means of each stream are clustered into a small codebook. Every output
+    state keeps a shortlist per codeword (Bocchieri, 1993): the mixtures whose
+    log likelihood at the codeword's centroid is within GS_SHORTLIST_BEAM of
+    the best one, which is always listed. For every frame, only the union of
+    the shortlists of the -K codewords nearest to the frame is evaluated, so
+    a state never backs off to more than its shortlisted mixtures. Applies to
+    the full output probability matrix used by geometric-duration (-g)
+    alignment.
+*/
+
+#define GS_KMEANS_ITER 10
+#define GS_SHORTLIST_BEAM 10.0
+
+typedef struct {
+  int ncluster;
+  int ndim;
+  FP_TYPE* centroid;  // ncluster x ndim
+  FP_TYPE* iscale;    // inverse of the average variance, per dimension
+  int** sbase;        // [gmm][codeword], offsets into slist; ncluster + 1
+  int** slist;        // [gmm][...], shortlisted mixtures of each codeword
+  FP_TYPE** lconst;   // [gmm][mixture], log weight + Gaussian normalization
+} gs_codebook;
+
+gs_codebook** gs_books = NULL;
+int opt_gscluster = 0;
+int opt_gsshortlist = 4;
+int opt_gsverify = 0;
+
+typedef struct {
+  int nfile;
+  double time_exact;
+  double time_select;
+  double sum_error;
+  double max_error;
+  long nvalue;
+  double sum_lh_error;
+  long nt;
+} gs_verify_stat;
+
+gs_verify_stat gs_stat = {0};
+
+static FP_TYPE gs_distance(FP_TYPE* x, FP_TYPE* c, FP_TYPE* iscale, int ndim) {
+  FP_TYPE d = 0;
+  for(int j = 0; j < ndim; j ++)
+    d += (x[j] - c[j]) * (x[j] - c[j]) * iscale[j];
+  return d;
+}
+
+static gs_codebook* create_gs_codebook(lrh_stream* st, int ncluster) {
+  gs_codebook* ret = malloc(sizeof(gs_codebook));
+  int ndim = st -> gmms[0] -> ndim;
+  int nmean = 0;
+  for(int i = 0; i < st -> ngmm; i ++)
+    nmean += st -> gmms[i] -> nmix;
+  ncluster = min(ncluster, nmean);
+  ret -> ncluster = ncluster;
+  ret -> ndim = ndim;
+  ret -> centroid = calloc(ncluster * ndim, sizeof(FP_TYPE));
+  ret -> iscale = calloc(ndim, sizeof(FP_TYPE));
+  ret -> sbase = malloc(st -> ngmm * sizeof(int*));
+  ret -> slist = malloc(st -> ngmm * sizeof(int*));
+  ret -> lconst = malloc(st -> ngmm * sizeof(FP_TYPE*));
+
+  // flatten the means
+  FP_TYPE** means = malloc(nmean * sizeof(FP_TYPE*));
+  int* assign = calloc(nmean, sizeof(int));
+  int n = 0;
+  for(int i = 0; i < st -> ngmm; i ++) {
+    lrh_gmm* g = st -> gmms[i];
+    ret -> lconst[i] = calloc(g -> nmix, sizeof(FP_TYPE));
+    for(int k = 0; k < g -> nmix; k ++) {
+      means[n ++] = & lrh_gmmu(g, k, 0);
+      // log(2 pi) = 1.8378770664
+      FP_TYPE c = log(g -> weight[k]) - 0.5 * ndim * 1.8378770664;
+      for(int j = 0; j < ndim; j ++) {
+        c -= 0.5 * log(lrh_gmmv(g, k, j));
+        ret -> iscale[j] += lrh_gmmv(g, k, j);
+      }
+      ret -> lconst[i][k] = c;
+    }
+  }
+  for(int j = 0; j < ndim; j ++)
+    ret -> iscale[j] = nmean / ret -> iscale[j];
+
+  // k-means, initialized from evenly spaced means
+  for(int c = 0; c < ncluster; c ++)
+    memcpy(ret -> centroid + c * ndim, means[(long)c * nmean / ncluster],
+      ndim * sizeof(FP_TYPE));
+  int* count = calloc(ncluster, sizeof(int));
+  for(int iter = 0; iter < GS_KMEANS_ITER; iter ++) {
+#   pragma omp parallel for
+    for(int m = 0; m < nmean; m ++) {
+      FP_TYPE best = INFINITY;
+      for(int c = 0; c < ncluster; c ++) {
+        FP_TYPE d = gs_distance(means[m], ret -> centroid + c * ndim,
+          ret -> iscale, ndim);
+        if(d < best) {
+          best = d;
+          assign[m] = c;
+        }
+      }
+    }
+    memset(count, 0, ncluster * sizeof(int));
+    FP_TYPE* sum = calloc(ncluster * ndim, sizeof(FP_TYPE));
+    for(int m = 0; m < nmean; m ++) {
+      count[assign[m]] ++;
+      for(int j = 0; j < ndim; j ++)
+        sum[assign[m] * ndim + j] += means[m][j];
+    }
+    for(int c = 0; c < ncluster; c ++) // empty clusters keep their centroid
+      if(count[c] > 0)
+        for(int j = 0; j < ndim; j ++)
+          ret -> centroid[c * ndim + j] = sum[c * ndim + j] / count[c];
+    free(sum);
+  }
+
+  // per-state shortlists, from the likelihood of each mixture at the centroids
+# pragma omp parallel for schedule(dynamic)
+  for(int i = 0; i < st -> ngmm; i ++) {
+    lrh_gmm* g = st -> gmms[i];
+    FP_TYPE lg[g -> nmix];
+    int* sbase = malloc((ncluster + 1) * sizeof(int));
+    int* slist = malloc(ncluster * g -> nmix * sizeof(int));
+    int nlist = 0;
+    for(int c = 0; c < ncluster; c ++) {
+      FP_TYPE* x = ret -> centroid + c * ndim;
+      FP_TYPE lmax = -INFINITY;
+      for(int k = 0; k < g -> nmix; k ++) {
+        FP_TYPE e = 0;
+        for(int j = 0; j < ndim; j ++) {
+          FP_TYPE d = x[j] - lrh_gmmu(g, k, j);
+          e += d * d / lrh_gmmv(g, k, j);
+        }
+        lg[k] = ret -> lconst[i][k] - 0.5 * e;
+        lmax = max(lmax, lg[k]);
+      }
+      sbase[c] = nlist;
+      for(int k = 0; k < g -> nmix; k ++)
+        if(lg[k] >= lmax - GS_SHORTLIST_BEAM)
+          slist[nlist ++] = k;
+      if(nlist == sbase[c]) // degenerate variances; keep one mixture
+        slist[nlist ++] = 0;
+    }
+    sbase[ncluster] = nlist;
+    ret -> sbase[i] = sbase;
+    ret -> slist[i] = realloc(slist, max(1, nlist) * sizeof(int));
+  }
+  free(count);
+  free(assign);
+  free(means);
+  return ret;
+}
+
+static void delete_gs_codebook(gs_codebook* dst, int ngmm) {
+  for(int i = 0; i < ngmm; i ++) {
+    free(dst -> sbase[i]);
+    free(dst -> slist[i]);
+    free(dst -> lconst[i]);
+  }
+  free(dst -> sbase);
+  free(dst -> slist);
+  free(dst -> lconst);
+  free(dst -> centroid);
+  free(dst -> iscale);
+  free(dst);
+}
+
+// log likelihood of x under the union of the shortlists of gmm i for the
+//   nshort codewords in near; mixmask has at least nmix entries, all zero
+static FP_TYPE gs_gmm_lg(lrh_gmm* g, gs_codebook* cb, int i, FP_TYPE* x,
+  int* near, int nshort, char* mixmask) {
+  FP_TYPE lg[g -> nmix];
+  int nsel = 0;
+  for(int n = 0; n < nshort; n ++)
+    for(int m = cb -> sbase[i][near[n]]; m < cb -> sbase[i][near[n] + 1];
+      m ++) {
+      int k = cb -> slist[i][m];
+      if(mixmask[k]) continue;
+      mixmask[k] = 1;
+      FP_TYPE e = 0;
+      for(int j = 0; j < g -> ndim; j ++) {
+        FP_TYPE d = x[j] - lrh_gmmu(g, k, j);
+        e += d * d / lrh_gmmv(g, k, j);
+      }
+      lg[nsel ++] = cb -> lconst[i][k] - 0.5 * e;
+    }
+  for(int n = 0; n < nshort; n ++)
+    for(int m = cb -> sbase[i][near[n]]; m < cb -> sbase[i][near[n] + 1];
+      m ++)
+      mixmask[cb -> slist[i][m]] = 0;
+  FP_TYPE lmax = lg[0];
+  for(int k = 1; k < nsel; k ++) lmax = max(lmax, lg[k]);
+  FP_TYPE acc = 0;
+  for(int k = 0; k < nsel; k ++) acc += exp(lg[k] - lmax);
+  return lmax + log(acc);
+}
+
+// same layout as lrh_sample_outputprob_lg_full: nt x nseg
+static FP_TYPE* gs_outputprob_full(lrh_model* h, lrh_observ* o, lrh_seg* s) {
+  FP_TYPE* ret = calloc(o -> nt * s -> nseg, sizeof(FP_TYPE));
+  for(int l = 0; l < h -> nstream; l ++) {
+    lrh_stream* st = h -> streams[l];
+    gs_codebook* cb = gs_books[l];
+    // evaluate each distinct output state once per frame
+    int* local = malloc(st -> ngmm * sizeof(int));
+    int* gmmidx = malloc(s -> nseg * sizeof(int));
+    int nlocal = 0;
+    for(int i = 0; i < st -> ngmm; i ++) local[i] = -1;
+    for(int i = 0; i < s -> nseg; i ++) {
+      int g = s -> outstate[l][i];
+      if(local[g] < 0) {
+        local[g] = nlocal;
+        gmmidx[nlocal ++] = g;
+      }
+    }
+    int nshort = min(opt_gsshortlist, cb -> ncluster);
+    int nmixmax = 1;
+    for(int k = 0; k < nlocal; k ++)
+      nmixmax = max(nmixmax, st -> gmms[gmmidx[k]] -> nmix);
+#   pragma omp parallel
+    {
+      FP_TYPE* val = malloc(nlocal * sizeof(FP_TYPE));
+      FP_TYPE* dist = malloc(cb -> ncluster * sizeof(FP_TYPE));
+      char* mask = malloc(cb -> ncluster);
+      int* near = malloc(nshort * sizeof(int));
+      char* mixmask = calloc(nmixmax, 1);
+#     pragma omp for
+      for(int t = 0; t < o -> nt; t ++) {
+        FP_TYPE* x = & lrh_obm(o, t, 0, l);
+        for(int c = 0; c < cb -> ncluster; c ++)
+          dist[c] = gs_distance(x, cb -> centroid + c * cb -> ndim,
+            cb -> iscale, cb -> ndim);
+        // mark the nshort nearest clusters
+        memset(mask, 0, cb -> ncluster);
+        for(int n = 0; n < nshort; n ++) {
+          int best = -1;
+          for(int c = 0; c < cb -> ncluster; c ++)
+            if(! mask[c] && (best < 0 || dist[c] < dist[best]))
+              best = c;
+          mask[best] = 1;
+          near[n] = best;
+        }
+        for(int k = 0; k < nlocal; k ++)
+          val[k] = gs_gmm_lg(st -> gmms[gmmidx[k]], cb, gmmidx[k], x,
+            near, nshort, mixmask);
+        for(int i = 0; i < s -> nseg; i ++)
+          ret[t * s -> nseg + i] += val[local[s -> outstate[l][i]]] *
+            st -> weight;
+      }
+      free(val);
+      free(dist);
+      free(mask);
+      free(near);
+      free(mixmask);
+    }
+    free(local);
+    free(gmmidx);
+  }
+  return ret;
+}
+
+// compare Gaussian selection against the exact output probabilities
+static FP_TYPE* gs_verify(lrh_model* hsmm, lrh_observ* o, lrh_seg* s) {
+  double t0 = omp_get_wtime();
+  FP_TYPE* exact = lrh_sample_outputprob_lg_full(hsmm, o, s);
+  double t1 = omp_get_wtime();
+  FP_TYPE* approx = gs_outputprob_full(hsmm, o, s);
+  double t2 = omp_get_wtime();
+  FP_TYPE lh_exact = 0, lh_approx = 0;
+  free(lrh_viterbi_geometric(hsmm, s, exact, o -> nt, & lh_exact));
+  free(lrh_viterbi_geometric(hsmm, s, approx, o -> nt, & lh_approx));
+  double sum = 0, hi = 0;
+  long n = 0;
+  for(long k = 0; k < (long)o -> nt * s -> nseg; k ++) {
+    if(! isfinite(exact[k]) || ! isfinite(approx[k])) continue;
+    double e = fabs(exact[k] - approx[k]);
+    sum += e;
+    hi = max(hi, e);
+    n ++;
+  }
+  free(exact);
+# pragma omp critical(gs_stat)
+  {
+    gs_stat.nfile ++;
+    gs_stat.time_exact += t1 - t0;
+    gs_stat.time_select += t2 - t1;
+    gs_stat.sum_error += sum;
+    gs_stat.max_error = max(gs_stat.max_error, hi);
+    gs_stat.nvalue += n;
+    gs_stat.sum_lh_error += fabs(lh_exact - lh_approx);
+    gs_stat.nt += o -> nt;
+  }
+  return approx;
+}
+
+static void create_gs_books(lrh_model* h) {
+  gs_books = malloc(h -> nstream * sizeof(gs_codebook*));
+  for(int l = 0; l < h -> nstream; l ++)
+    gs_books[l] = create_gs_codebook(h -> streams[l], opt_gscluster);
+}
+
+static void delete_gs_books(lrh_model* h) {
+  if(gs_books == NULL) return;
+  for(int l = 0; l < h -> nstream; l ++)
+    delete_gs_codebook(gs_books[l], h -> streams[l] -> ngmm);
+  free(gs_books);
+  gs_books = NULL;
+}
+
+static void print_gs_verify_stat() {
+  if(gs_stat.nfile == 0) return;
+  fprintf(stderr, "Gaussian selection (%d clusters, shortlist %d): "
+    "%.2fx faster output probability evaluation (%.3fs vs %.3fs).\n",
+    opt_gscluster, opt_gsshortlist, gs_stat.time_exact / gs_stat.time_select,
+    gs_stat.time_select, gs_stat.time_exact);
+  fprintf(stderr, "Gaussian selection: mean abs. error = %g, max. abs. error "
+    "= %g (log output probability), mean Viterbi log likelihood error = %g "
+    "per frame.\n", gs_stat.nvalue > 0 ? gs_stat.sum_error / gs_stat.nvalue :
+    0, gs_stat.max_error, gs_stat.nt > 0 ? gs_stat.sum_lh_error / gs_stat.nt :
+    0);
+}
 
 static cJSON* align(lrh_model* hsmm, lrh_observ* o, cJSON* j_states) {
   FP_TYPE* outp = NULL;
@@ -111,6 +736,16 @@ static cJSON* align(lrh_model* hsmm, lrh_observ* o, cJSON* j_states) {
       lrh_delete_seg(s);
       free(realign);
       delete_dataset(d);
+  } else if(opt_decimation > 1 || opt_longchunk > 0) {
+    lrh_seg* s = load_seg_from_json(j_states, hsmm -> nstream);
+    search_failures = 0;
+    int* endtime = opt_longchunk > 0 ? align_long_form(hsmm, o, s) :
+      align_coarse_to_fine(hsmm, o, s);
+    record_prune_stat(s, endtime, o -> nt, search_failures);
+    int* realign = shufidx_from_endtime(endtime, s -> nseg);
+    j_states = json_from_seg_shuffle(s, j_states, realign);
+    free(realign); free(endtime);
+    lrh_delete_seg(s);
   } else {
     lrh_seg* s = load_seg_from_json(j_states, hsmm -> nstream);
     for(int i = 0; i < s -> nseg; i ++)
@@ -119,15 +754,36 @@ static cJSON* align(lrh_model* hsmm, lrh_observ* o, cJSON* j_states) {
     lrh_seg_buildjumps(s);
 
     int* realign = NULL;
+    prof_stamp p = prof_start();
     if(opt_geodur) {
-      outp = lrh_sample_outputprob_lg_full(hsmm, o, s);
+      if(gs_books != NULL && opt_gsverify)
+        outp = gs_verify(hsmm, o, s);
+      else if(gs_books != NULL)
+        outp = gs_outputprob_full(hsmm, o, s);
+      else
+        outp = lrh_sample_outputprob_lg_full(hsmm, o, s);
+      prof_stop(p, "outputprob", prof_file, o -> nt, s -> nseg);
+      p = prof_start();
       realign = lrh_viterbi_geometric(hsmm, s, outp, o -> nt, NULL);
-      for(int i = 0; i < s -> nseg; i ++)
-        s -> time[i] = realign[i];
+      prof_stop(p, "viterbi", prof_file, o -> nt, s -> nseg);
+      if(realign != NULL)
+        for(int i = 0; i < s -> nseg; i ++)
+          s -> time[i] = realign[i];
       j_states = json_from_seg(s, j_states);
     } else {
       outp = lrh_sample_outputprob_lg(hsmm, o, s);
+      prof_stop(p, "outputprob", prof_file, o -> nt, s -> nseg);
+      p = prof_start();
       realign = lrh_viterbi(hsmm, s, outp, o -> nt, NULL);
+      prof_stop(p, "viterbi", prof_file, o -> nt, s -> nseg);
+      if(fp_prune != NULL && realign == NULL)
+        record_prune_stat(s, NULL, o -> nt, 1);
+      else if(fp_prune != NULL) {
+        int* endtime = malloc(s -> nseg * sizeof(int));
+        endtime_from_realign(realign, s -> nseg, endtime);
+        record_prune_stat(s, endtime, o -> nt, 0);
+        free(endtime);
+      }
       j_states = json_from_seg_shuffle(s, j_states, realign);
     }
     free(outp); free(realign);
@@ -136,6 +792,627 @@ static cJSON* align(lrh_model* hsmm, lrh_observ* o, cJSON* j_states) {
   return j_states;
 }
 
+/*
+  Server mode: the model is loaded and precomputed once; each job is a single
+    line of JSON, {"id": ..., "filename": ..., "states": [...]}, answered by a
+    single line {"id": ..., "filename": ..., "states": [...], "latency": ms}
+    or {"id": ..., "error": ...}. Jobs are processed by a pool of worker
+    threads and answers may come out of order.
+*/
+
+typedef struct {
+  double* latency;
+  int njob;
+  int nfailed;
+  int capacity;
+} server_stat;
+
+server_stat srv_stat = {NULL, 0, 0, 0};
+volatile sig_atomic_t srv_stop = 0;
+int srv_socket = -1;
+
+static int compare_double(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void print_server_stat() {
+  int n = srv_stat.njob;
+  if(n == 0) return;
+  double* sorted = malloc(n * sizeof(double));
+  memcpy(sorted, srv_stat.latency, n * sizeof(double));
+  qsort(sorted, n, sizeof(double), compare_double);
+  double sum = 0;
+  for(int i = 0; i < n; i ++) sum += sorted[i];
+  fprintf(stderr, "Jobs: %d (%d failed); latency (ms): mean = %.2f, "
+    "p50 = %.2f, p95 = %.2f, p99 = %.2f, max = %.2f.\n", n, srv_stat.nfailed,
+    sum / n, sorted[n / 2], sorted[(int)(n * 0.95)], sorted[(int)(n * 0.99)],
+    sorted[n - 1]);
+  free(sorted);
+}
+
+static void record_latency(double latency, int failed) {
+# pragma omp critical(server_stat)
+  {
+    if(srv_stat.njob == srv_stat.capacity) {
+      srv_stat.capacity = srv_stat.capacity * 2 + 256;
+      srv_stat.latency = realloc(srv_stat.latency,
+        srv_stat.capacity * sizeof(double));
+    }
+    srv_stat.latency[srv_stat.njob ++] = latency;
+    srv_stat.nfailed += failed;
+    if(srv_stat.njob % 1000 == 0)
+      print_server_stat();
+  }
+}
+
+static int check_number(cJSON* j, int lo, int hi) {
+  return j != NULL && j -> type == cJSON_Number && j -> valueint >= lo &&
+    j -> valueint < hi;
+}
+
+// whether load_seg_from_json accepts j_states without exiting and all state
+//   indices are within the model
+static int check_states(lrh_model* hsmm, cJSON* j_states) {
+  if(j_states -> type != cJSON_Array || cJSON_GetArraySize(j_states) == 0)
+    return 0;
+  int nseg = cJSON_GetArraySize(j_states);
+  int i = 0;
+  for(cJSON* j_s = j_states -> child; j_s != NULL; j_s = j_s -> next, i ++) {
+    if(j_s -> type != cJSON_Object) return 0;
+    if(! opt_embdalign && cJSON_GetObjectItem(j_s, "ext") == NULL) return 0;
+    if(! check_number(cJSON_GetObjectItem(j_s, "dur"), 0, hsmm -> nduration))
+      return 0;
+    cJSON* j_time = cJSON_GetObjectItem(j_s, "time");
+    if(j_time != NULL && j_time -> type != cJSON_Number) return 0;
+    cJSON* j_out = cJSON_GetObjectItem(j_s, "out");
+    if(j_out == NULL || j_out -> type != cJSON_Array ||
+       cJSON_GetArraySize(j_out) != hsmm -> nstream)
+      return 0;
+    for(int l = 0; l < hsmm -> nstream; l ++)
+      if(! check_number(cJSON_GetArrayItem(j_out, l), 0,
+        hsmm -> streams[l] -> ngmm))
+        return 0;
+    cJSON* j_jmp = cJSON_GetObjectItem(j_s, "jmp");
+    if(j_jmp == NULL) continue;
+    if(j_jmp -> type != cJSON_Array) return 0;
+    for(cJSON* j_k = j_jmp -> child; j_k != NULL; j_k = j_k -> next) {
+      cJSON* j_d = cJSON_GetObjectItem(j_k, "d");
+      cJSON* j_p = cJSON_GetObjectItem(j_k, "p");
+      // a jump other than to the next state must land within the utterance
+      if(! check_number(j_d, 1, max(2, nseg - i)) ||
+         j_p == NULL || j_p -> type != cJSON_Number)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static char* serve_job(lrh_model* hsmm, const char* line) {
+  double t0 = omp_get_wtime();
+  cJSON* j_resp = cJSON_CreateObject();
+  cJSON* j_job = cJSON_Parse(line);
+  const char* error = NULL;
+  if(j_job == NULL) {
+    error = "malformed job";
+  } else {
+    cJSON* j_id = cJSON_GetObjectItem(j_job, "id");
+    cJSON* j_filename = cJSON_GetObjectItem(j_job, "filename");
+    cJSON* j_states = cJSON_GetObjectItem(j_job, "states");
+    if(j_id != NULL)
+      cJSON_AddItemToObject(j_resp, "id", cJSON_Duplicate(j_id, 1));
+    if(j_filename == NULL || j_filename -> valuestring == NULL)
+      error = "missing attribute \"filename\"";
+    else if(j_states == NULL)
+      error = "missing attribute \"states\"";
+    else if(! check_states(hsmm, j_states))
+      error = "invalid states";
+    else {
+      lrh_observ* o = load_observ_from_float(j_filename -> valuestring, hsmm);
+      if(o == NULL)
+        error = "cannot load features";
+      else {
+        cJSON_AddStringToObject(j_resp, "filename", j_filename -> valuestring);
+        cJSON_AddItemToObject(j_resp, "states", align(hsmm, o, j_states));
+        lrh_delete_observ(o);
+      }
+    }
+    cJSON_Delete(j_job);
+  }
+  if(error != NULL)
+    cJSON_AddStringToObject(j_resp, "error", error);
+  double latency = (omp_get_wtime() - t0) * 1000.0;
+  if(error == NULL)
+    cJSON_AddNumberToObject(j_resp, "latency", latency);
+  record_latency(latency, error != NULL);
+  char* ret = cJSON_PrintUnformatted(j_resp);
+  cJSON_Delete(j_resp);
+  return ret;
+}
+
+static void serve_stdin(lrh_model* hsmm) {
+# pragma omp parallel
+  {
+    while(1) {
+      char* line = NULL;
+#     pragma omp critical(server_input)
+      line = read_line(stdin);
+      if(line == NULL) break;
+      if(line[strspn(line, " \t\r\n")] == 0) { // skip blank lines
+        free(line);
+        continue;
+      }
+      char* resp = serve_job(hsmm, line);
+#     pragma omp critical(server_output)
+      {
+        printf("%s\n", resp);
+        fflush(stdout);
+      }
+      free(resp);
+      free(line);
+    }
+  }
+}
+
+#ifndef _WIN32
+static void on_server_signal(int sig) {
+  srv_stop = 1;
+  if(srv_socket >= 0)
+    shutdown(srv_socket, SHUT_RDWR); // wakes up the workers blocked in accept
+}
+
+static int write_all(int fd, const char* data, size_t size) {
+  while(size > 0) {
+    ssize_t n = write(fd, data, size);
+    if(n <= 0) return 0;
+    data += n;
+    size -= n;
+  }
+  return 1;
+}
+
+// serve all jobs on a connection; jobs on the same connection run in order
+static void serve_connection(lrh_model* hsmm, int fd) {
+  int capacity = 4096;
+  int size = 0;
+  char* buffer = malloc(capacity);
+  while(! srv_stop) {
+    if(size == capacity) {
+      capacity *= 2;
+      buffer = realloc(buffer, capacity);
+    }
+    ssize_t n = read(fd, buffer + size, capacity - size);
+    if(n <= 0) break;
+    size += n;
+    char* head = buffer;
+    char* eol = NULL;
+    while((eol = memchr(head, '\n', size - (head - buffer))) != NULL) {
+      *eol = 0;
+      if(head[strspn(head, " \t\r")] != 0) {
+        char* resp = serve_job(hsmm, head);
+        int ok = write_all(fd, resp, strlen(resp)) && write_all(fd, "\n", 1);
+        free(resp);
+        if(! ok) {
+          free(buffer);
+          return;
+        }
+      }
+      head = eol + 1;
+    }
+    size -= head - buffer;
+    memmove(buffer, head, size);
+  }
+  free(buffer);
+}
+
+static void serve_socket(lrh_model* hsmm, const char* path) {
+  struct sockaddr_un addr;
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Error: socket path %s is too long.\n", path);
+    exit(1);
+  }
+  memset(& addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  srv_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if(srv_socket < 0 || bind(srv_socket, (struct sockaddr*)& addr,
+    sizeof(addr)) != 0 || listen(srv_socket, 64) != 0) {
+    fprintf(stderr, "Error: cannot listen on %s.\n", path);
+    exit(1);
+  }
+  signal(SIGINT, on_server_signal);
+  signal(SIGTERM, on_server_signal);
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, "Listening on %s.\n", path);
+
+# pragma omp parallel
+  {
+    while(! srv_stop) {
+      int fd = accept(srv_socket, NULL, NULL);
+      if(fd < 0) continue;
+      serve_connection(hsmm, fd);
+      close(fd);
+    }
+  }
+  close(srv_socket);
+  unlink(path);
+}
+#endif
+
+/*
+  Online alignment: frames of a single utterance are read from stdin as they
+    arrive. Every opt_interval frames the uncommitted part of the utterance is
+    decoded twice, with and without the newest frames. State boundaries on
+    which both tracebacks agree have converged and are committed to stdout,
+    one line of JSON per state. Only the frames after the last committed
+    boundary are kept in memory; if the window grows beyond opt_maxwindow,
+    the states ending in the first half of its frames (at least one state)
+    are committed regardless.
+*/
+
+static void online_decode(lrh_model* hsmm, lrh_seg* s, float* frames,
+  int* ndim, int i0, int i1, int nt, int* endtime) {
+  lrh_observ* o = lrh_create_observ(hsmm -> nstream, nt, ndim);
+  int c = 0;
+  for(int t = 0; t < nt; t ++)
+    for(int l = 0; l < hsmm -> nstream; l ++)
+      for(int n = 0; n < ndim[l]; n ++)
+        lrh_obm(o, t, n, l) = frames[c ++];
+  lrh_seg* ws = slice_seg(s, i0, i1, 0);
+  distribute_by_duration(hsmm, ws, nt);
+  viterbi_endtime(hsmm, o, ws, opt_geodur, endtime);
+  lrh_delete_seg(ws);
+  lrh_delete_observ(o);
+}
+
+static void online_commit(cJSON* j_states, int i, int t) {
+  cJSON* j_commit = cJSON_CreateObject();
+  cJSON_AddNumberToObject(j_commit, "state", i);
+  cJSON_AddNumberToObject(j_commit, "time", t);
+  cJSON* j_ext = cJSON_GetObjectItem(cJSON_GetArrayItem(j_states, i), "ext");
+  if(j_ext != NULL)
+    cJSON_AddItemToObject(j_commit, "ext", cJSON_Duplicate(j_ext, 1));
+  char* line = cJSON_PrintUnformatted(j_commit);
+  printf("%s\n", line);
+  fflush(stdout);
+  free(line);
+  cJSON_Delete(j_commit);
+}
+
+static void align_online(lrh_model* hsmm, cJSON* j_states) {
+  lrh_seg* s = load_seg_from_json(j_states, hsmm -> nstream);
+  int nseg = s -> nseg;
+  int* ndim = calloc(hsmm -> nstream, sizeof(int));
+  int stride = 0;
+  for(int l = 0; l < hsmm -> nstream; l ++) {
+    ndim[l] = hsmm -> streams[l] -> gmms[0] -> ndim;
+    stride += ndim[l];
+  }
+
+  int capacity = opt_maxwindow + opt_interval * 2;
+  float* frames = malloc(capacity * stride * sizeof(float));
+  int* endtime_a = calloc(nseg, sizeof(int));
+  int* endtime_b = calloc(nseg, sizeof(int));
+  int nwin = 0;   // number of frames in the window
+  int tc = 0;     // time of the last committed boundary
+  int sc = 0;     // index of the first uncommitted state
+  while(sc < nseg) {
+    if(nwin + opt_interval > capacity) {
+      capacity = (nwin + opt_interval) * 2;
+      frames = realloc(frames, capacity * stride * sizeof(float));
+    }
+    int nread = fread(frames + nwin * stride, sizeof(float),
+      opt_interval * stride, stdin) / stride;
+    nwin += nread;
+    if(nread < opt_interval) break;
+    if(nwin < opt_interval * 2) continue;
+
+    int se_a = online_lookahead(hsmm, s, sc, nwin);
+    int se_b = online_lookahead(hsmm, s, sc, nwin - opt_interval);
+    online_decode(hsmm, s, frames, ndim, sc, se_a, nwin, endtime_a);
+    online_decode(hsmm, s, frames, ndim, sc, se_b, nwin - opt_interval,
+      endtime_b);
+
+    // the last two states of each window are pinned by the forced end
+    int ncommit = 0;
+    int nstable = min(se_a, se_b) - sc - 2;
+    while(ncommit < nstable && endtime_a[ncommit] == endtime_b[ncommit] &&
+      endtime_a[ncommit] <= nwin - opt_interval)
+      ncommit ++;
+    // window too long: commit the states ending in its first half, and at
+    //   least one state so that the window always shrinks
+    if(ncommit == 0 && nwin > opt_maxwindow) {
+      while(ncommit < se_a - sc - 1 && endtime_a[ncommit] <= nwin / 2)
+        ncommit ++;
+      ncommit = max(1, ncommit);
+    }
+    if(ncommit == 0) continue;
+
+    for(int i = 0; i < ncommit; i ++)
+      online_commit(j_states, sc + i, tc + endtime_a[i]);
+    int shift = endtime_a[ncommit - 1];
+    memmove(frames, frames + shift * stride, (nwin - shift) * stride *
+      sizeof(float));
+    nwin -= shift;
+    tc += shift;
+    sc += ncommit;
+  }
+
+  // end of stream: the remaining states are aligned to the remaining frames
+  if(sc < nseg) {
+    if(nwin > 0)
+      online_decode(hsmm, s, frames, ndim, sc, nseg, nwin, endtime_a);
+    else
+      memset(endtime_a, 0, nseg * sizeof(int));
+    for(int i = sc; i < nseg; i ++)
+      online_commit(j_states, i, tc + endtime_a[i - sc]);
+  }
+
+  free(endtime_a);
+  free(endtime_b);
+  free(frames);
+  free(ndim);
+  lrh_delete_seg(s);
+}
+
+/*
+  Calibration: a random sample of the file list is aligned with the current
+    (assumed generous) -p and -d as a reference, then with -p and afterwards
+    -d tightened step by step for as long as the share of state boundaries
+    within one frame of the reference stays above the target.
+*/
+
+#define CALIB_TOLERANCE 1
+#define CALIB_SHRINK 0.7
+
+typedef struct {
+  int nfile;
+  lrh_observ** o;
+  lrh_seg** s;
+  int** endtime;
+} calib_set;
+
+// align every file of the set under the current pruning settings
+static double calib_run(lrh_model* hsmm, calib_set* c, int** dst) {
+  double t0 = omp_get_wtime();
+# pragma omp parallel for schedule(dynamic)
+  for(int f = 0; f < c -> nfile; f ++)
+    viterbi_endtime(hsmm, c -> o[f], c -> s[f], 0, dst[f]);
+  return omp_get_wtime() - t0;
+}
+
+static double calib_agreement(calib_set* c, int** endtime) {
+  long nmatch = 0;
+  long ntotal = 0;
+  for(int f = 0; f < c -> nfile; f ++)
+    for(int i = 0; i < c -> s[f] -> nseg - 1; i ++) {
+      nmatch += abs(endtime[f][i] - c -> endtime[f][i]) <= CALIB_TOLERANCE;
+      ntotal ++;
+    }
+  return ntotal > 0 ? (double)nmatch / ntotal : 1.0;
+}
+
+static cJSON* calib_trial(lrh_model* hsmm, calib_set* c, int** buffer,
+  double* agreement, double* elapsed) {
+  *elapsed = calib_run(hsmm, c, buffer);
+  *agreement = calib_agreement(c, buffer);
+  fprintf(stderr, "Calibration: -p %d -d %d, agreement = %.4f, "
+    "time = %.3fs\n", lrh_inference_stprune, lrh_inference_duration_extra,
+    *agreement, *elapsed);
+  cJSON* j_trial = cJSON_CreateObject();
+  cJSON_AddNumberToObject(j_trial, "stprune", lrh_inference_stprune);
+  cJSON_AddNumberToObject(j_trial, "duration_extra",
+    lrh_inference_duration_extra);
+  cJSON_AddNumberToObject(j_trial, "agreement", *agreement);
+  cJSON_AddNumberToObject(j_trial, "time", *elapsed);
+  return j_trial;
+}
+
+// shrink *param for as long as the agreement stays above the target
+static void calib_tighten(lrh_model* hsmm, calib_set* c, int** buffer,
+  int* param, int lower, cJSON* j_trials, double* best_agreement,
+  double* best_time) {
+  while(1) {
+    int prev = *param;
+    int cand = max(lower, (int)(prev * CALIB_SHRINK));
+    if(cand >= prev) break;
+    *param = cand;
+    double agreement, elapsed;
+    cJSON_AddItemToArray(j_trials,
+      calib_trial(hsmm, c, buffer, & agreement, & elapsed));
+    if(agreement < opt_agreement) {
+      *param = prev;
+      break;
+    }
+    *best_agreement = agreement;
+    *best_time = elapsed;
+  }
+}
+
+static cJSON* calibrate(lrh_model* hsmm, cJSON* j_file_list) {
+  int nfile = cJSON_GetArraySize(j_file_list);
+  int* order = malloc(nfile * sizeof(int));
+  for(int f = 0; f < nfile; f ++) order[f] = f;
+  srand(1);
+  calib_set c;
+  c.nfile = min(opt_calibrate, nfile);
+  for(int f = 0; f < c.nfile; f ++) { // partial Fisher-Yates shuffle
+    int r = f + rand() % (nfile - f);
+    int tmp = order[f]; order[f] = order[r]; order[r] = tmp;
+  }
+  c.o = calloc(c.nfile, sizeof(lrh_observ*));
+  c.s = calloc(c.nfile, sizeof(lrh_seg*));
+  c.endtime = calloc(c.nfile, sizeof(int*));
+  int** buffer = calloc(c.nfile, sizeof(int*));
+  for(int f = 0; f < c.nfile; f ++) {
+    cJSON* j_file_list_f = cJSON_GetArrayItem(j_file_list, order[f]);
+    cJSON* j_filename = cJSON_GetObjectItem(j_file_list_f, "filename");
+    checkvar(filename);
+    cJSON* j_states = cJSON_GetObjectItem(j_file_list_f, "states");
+    checkvar(states);
+    c.o[f] = load_observ_from_float(j_filename -> valuestring, hsmm);
+    if(c.o[f] == NULL) exit(1);
+    c.s[f] = load_seg_from_json(j_states, hsmm -> nstream);
+    c.endtime[f] = calloc(c.s[f] -> nseg, sizeof(int));
+    buffer[f] = calloc(c.s[f] -> nseg, sizeof(int));
+  }
+  free(order);
+
+  cJSON* j_trials = cJSON_CreateArray();
+  double ref_time = calib_run(hsmm, & c, c.endtime);
+  int ref_stprune = lrh_inference_stprune;
+  int ref_duration_extra = lrh_inference_duration_extra;
+  fprintf(stderr, "Calibration: reference -p %d -d %d on %d files, "
+    "time = %.3fs\n", ref_stprune, ref_duration_extra, c.nfile, ref_time);
+
+  double best_agreement = 1.0;
+  double best_time = ref_time;
+  calib_tighten(hsmm, & c, buffer, & lrh_inference_stprune, 1, j_trials,
+    & best_agreement, & best_time);
+  calib_tighten(hsmm, & c, buffer, & lrh_inference_duration_extra, 0,
+    j_trials, & best_agreement, & best_time);
+  fprintf(stderr, "Calibration: suggested -p %d -d %d (agreement = %.4f, "
+    "%.2fx faster than the reference).\n", lrh_inference_stprune,
+    lrh_inference_duration_extra, best_agreement, ref_time / best_time);
+
+  cJSON* j_ret = cJSON_CreateObject();
+  cJSON_AddNumberToObject(j_ret, "stprune", lrh_inference_stprune);
+  cJSON_AddNumberToObject(j_ret, "duration_extra",
+    lrh_inference_duration_extra);
+  cJSON_AddNumberToObject(j_ret, "agreement", best_agreement);
+  cJSON_AddNumberToObject(j_ret, "time", best_time);
+  cJSON* j_ref = cJSON_CreateObject();
+  cJSON_AddNumberToObject(j_ref, "stprune", ref_stprune);
+  cJSON_AddNumberToObject(j_ref, "duration_extra", ref_duration_extra);
+  cJSON_AddNumberToObject(j_ref, "time", ref_time);
+  cJSON_AddItemToObject(j_ret, "reference", j_ref);
+  cJSON_AddNumberToObject(j_ret, "target_agreement", opt_agreement);
+  cJSON_AddNumberToObject(j_ret, "num_files", c.nfile);
+  cJSON_AddItemToObject(j_ret, "trials", j_trials);
+
+  for(int f = 0; f < c.nfile; f ++) {
+    lrh_delete_observ(c.o[f]);
+    lrh_delete_seg(c.s[f]);
+    free(c.endtime[f]);
+    free(buffer[f]);
+  }
+  free(c.o); free(c.s); free(c.endtime); free(buffer);
+  return j_ret;
+}
+
+/*
+  Incremental alignment: each file_list entry is keyed by a hash of the
+    feature file, the input states, the model parameters and the alignment
+    options. Results are kept in a cache directory as <key>.json, so that
+    re-running over a corpus only aligns the entries whose key changed.
+*/
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+char* opt_cachedir = NULL;
+uint64_t model_hash = 0;
+
+static uint64_t fnv1a(uint64_t h, const void* data, size_t size) {
+  const uint8_t* p = data;
+  for(size_t i = 0; i < size; i ++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static int fnv1a_file(uint64_t* h, const char* path) {
+  FILE* fin = fopen(path, "rb");
+  if(fin == NULL) return 0;
+  uint8_t buffer[65536];
+  size_t n;
+  while((n = fread(buffer, 1, sizeof(buffer), fin)) > 0)
+    *h = fnv1a(*h, buffer, n);
+  fclose(fin);
+  return 1;
+}
+
+static uint64_t hash_model(lrh_model* h) {
+  uint64_t ret = FNV_OFFSET;
+  for(int l = 0; l < h -> nstream; l ++) {
+    lrh_stream* st = h -> streams[l];
+    ret = fnv1a(ret, & st -> weight, sizeof(FP_TYPE));
+    for(int i = 0; i < st -> ngmm; i ++) {
+      lrh_gmm* g = st -> gmms[i];
+      size_t size = (size_t)g -> nmix * g -> ndim * sizeof(FP_TYPE);
+      ret = fnv1a(ret, g -> weight, g -> nmix * sizeof(FP_TYPE));
+      ret = fnv1a(ret, g -> mean, size);
+      ret = fnv1a(ret, g -> var, size);
+    }
+  }
+  for(int i = 0; i < h -> nduration; i ++) {
+    lrh_duration* d = h -> durations[i];
+    FP_TYPE dur[4] = {d -> mean, d -> var, d -> floor, d -> ceil};
+    ret = fnv1a(ret, dur, sizeof(dur));
+  }
+  return ret;
+}
+
+// returns 0 if the feature file cannot be read
+static uint64_t alignment_key(const char* filename, cJSON* j_states) {
+  uint64_t h = FNV_OFFSET;
+  if(! fnv1a_file(& h, filename)) return 0;
+  char* states = cJSON_PrintUnformatted(j_states);
+  h = fnv1a(h, states, strlen(states));
+  free(states);
+  if(feature_cmvn != NULL) {
+    int size = feature_cmvn -> ngroup * feature_cmvn -> ndim * sizeof(FP_TYPE);
+    h = fnv1a(h, & feature_cmvn -> mode, sizeof(int));
+    h = fnv1a(h, feature_cmvn -> mean, size);
+    h = fnv1a(h, feature_cmvn -> istd, size);
+  }
+  char options[256];
+  sprintf(options, "%016llx|%d|%d|%d|%g|%d|%d|%d|%d|%d|%d",
+    (unsigned long long)model_hash, opt_geodur, opt_embdalign,
+    lrh_inference_stprune, (double)lrh_inference_stprune_full_slope,
+    lrh_inference_duration_extra, opt_decimation, opt_chunksize,
+    opt_longchunk, opt_gscluster, opt_gsshortlist);
+  return fnv1a(h, options, strlen(options));
+}
+
+static char* cache_path(uint64_t key) {
+  char* ret = malloc(strlen(opt_cachedir) + 32);
+  sprintf(ret, "%s/%016llx.json", opt_cachedir, (unsigned long long)key);
+  return ret;
+}
+
+static cJSON* cache_lookup(uint64_t key) {
+  char* path = cache_path(key);
+  char* jsonstr = readall(path);
+  free(path);
+  if(jsonstr == NULL) return NULL;
+  cJSON* ret = cJSON_Parse(jsonstr);
+  free(jsonstr);
+  return ret;
+}
+
+static void cache_store(uint64_t key, cJSON* j_states) {
+  char* path = cache_path(key);
+  char* path_tmp = malloc(strlen(path) + 8);
+  sprintf(path_tmp, "%s.tmp", path);
+  FILE* fout = fopen(path_tmp, "w");
+  if(fout == NULL) {
+    fprintf(stderr, "Warning: cannot write to %s.\n", path_tmp);
+  } else {
+    char* jsonstr = cJSON_PrintUnformatted(j_states);
+    fprintf(fout, "%s\n", jsonstr);
+    free(jsonstr);
+    fclose(fout);
+    remove(path);
+    rename(path_tmp, path);
+  }
+  free(path_tmp);
+  free(path);
+}
+
 extern char* optarg;
 int main(int argc, char** argv) {
 # ifdef _WIN32
@@ -145,11 +1422,14 @@ int main(int argc, char** argv) {
   cJSON* j_segm = NULL;
   lrh_model* hsmm = NULL;
 
-  while((c = getopt(argc, argv, "m:s:gp:P:d:ih")) != -1) {
+  prof_init("shiro-align");
+  while((c = getopt(argc, argv, "m:s:gp:P:d:ic:b:L:Su:TOw:W:R:C:A:G:K:Vx:N:h")) != -1) {
     char* jsonstr = NULL;
+    prof_stamp p = prof_start();
     switch(c) {
     case 'm':
       hsmm = load_model(optarg);
+      prof_stop(p, "load_model", -1, 0, 0);
       if(hsmm == NULL) {
         fprintf(stderr, "Error: failed to load model from %s\n", optarg);
         return 1;
@@ -167,6 +1447,7 @@ int main(int argc, char** argv) {
         return 1;
       }
       free(jsonstr);
+      prof_stop(p, "parse_json", -1, 0, 0);
     break;
     case 'g':
       opt_geodur = 1;
@@ -183,6 +1464,94 @@ int main(int argc, char** argv) {
     case 'i':
       opt_embdalign = 0;
     break;
+    case 'c':
+      opt_decimation = atoi(optarg);
+    break;
+    case 'b':
+      opt_chunksize = atoi(optarg);
+      if(opt_chunksize < 2) {
+        fprintf(stderr, "Error: invalid chunk size.\n");
+        return 1;
+      }
+    break;
+    case 'L':
+      opt_longchunk = atoi(optarg);
+    break;
+    case 'S':
+      opt_server = 1;
+    break;
+    case 'u':
+#     ifdef _WIN32
+      fprintf(stderr, "Error: unix domain sockets are not supported on this "
+        "platform.\n");
+      return 1;
+#     endif
+      opt_server = 1;
+      opt_socket = optarg;
+    break;
+    case 'T':
+      opt_mthread = 1;
+    break;
+    case 'O':
+      opt_online = 1;
+    break;
+    case 'w':
+      opt_interval = atoi(optarg);
+      if(opt_interval < 1) {
+        fprintf(stderr, "Error: invalid update interval.\n");
+        return 1;
+      }
+    break;
+    case 'W':
+      opt_maxwindow = atoi(optarg);
+    break;
+    case 'G':
+      opt_gscluster = atoi(optarg);
+    break;
+    case 'K':
+      opt_gsshortlist = atoi(optarg);
+      if(opt_gsshortlist < 1) {
+        fprintf(stderr, "Error: invalid shortlist size.\n");
+        return 1;
+      }
+    break;
+    case 'V':
+      opt_gsverify = 1;
+    break;
+    case 'x':
+      opt_cachedir = optarg;
+#     ifdef _WIN32
+      _mkdir(optarg);
+#     else
+      mkdir(optarg, 0755);
+#     endif
+    break;
+    case 'C':
+      opt_calibrate = atoi(optarg);
+      if(opt_calibrate < 1) {
+        fprintf(stderr, "Error: invalid number of calibration files.\n");
+        return 1;
+      }
+    break;
+    case 'A':
+      opt_agreement = atof(optarg);
+    break;
+    case 'R':
+      fp_prune = fopen(optarg, "w");
+      if(fp_prune == NULL) {
+        fprintf(stderr, "Error: cannot create %s\n", optarg);
+        exit(1);
+      }
+      print_prune_header(fp_prune, "");
+    break;
+    case 'N':
+      feature_cmvn = load_cmvn(optarg);
+      if(feature_cmvn == NULL) {
+        fprintf(stderr, "Error: failed to load normalization statistics from "
+          "%s.\n", optarg);
+        return 1;
+      }
+    break;
     case 'h':
       print_usage();
     break;
@@ -190,20 +1559,103 @@ int main(int argc, char** argv) {
       abort();
     }
   }
-  if(j_segm == NULL) {
-    fprintf(stderr, "Error: cegmentation file is not specified.\n");
-    return 1;
-  }
   if(hsmm == NULL) {
     fprintf(stderr, "Error: model file is not specified.\n");
     return 1;
   }
+# ifdef _OPENMP
+  if(opt_mthread == 0)
+    omp_set_num_threads(1);
+# endif
+# ifndef _OPENMP
+  if(opt_mthread == 1)
+    fprintf(stderr, "Warning: OpenMP is not supported by this build.\n");
+# endif
+  if(fp_prune != NULL && (opt_server || opt_online || opt_geodur ||
+    ! opt_embdalign)) {
+    fprintf(stderr, "Warning: pruning statistics are only available for "
+      "embedded batch alignment with explicit durations.\n");
+    fclose(fp_prune);
+    fp_prune = NULL;
+  }
+  if(opt_gscluster > 0) {
+    if(! opt_geodur)
+      fprintf(stderr, "Warning: Gaussian selection is only available for "
+        "geometric-duration (-g) alignment.\n");
+    else
+      create_gs_books(hsmm);
+  }
+  if(opt_decimation > 1 || opt_longchunk > 0) {
+    if(! opt_embdalign) {
+      fprintf(stderr, "Warning: coarse-to-fine and long-form alignment "
+        "disabled due to -i option.\n");
+      opt_decimation = 0;
+      opt_longchunk = 0;
+    } else
+      hsmm_coarse = create_coarse_model(hsmm,
+        opt_decimation > 1 ? opt_decimation : 4);
+  }
+  if(opt_server) {
+    model_precompute(hsmm);
+#   ifndef _WIN32
+    if(opt_socket != NULL)
+      serve_socket(hsmm, opt_socket);
+    else
+#   endif
+      serve_stdin(hsmm);
+    print_server_stat();
+    free(srv_stat.latency);
+    if(hsmm_coarse != NULL) delete_coarse_model(hsmm_coarse);
+    delete_gs_books(hsmm);
+    if(j_segm != NULL) cJSON_Delete(j_segm);
+    delete_model(hsmm);
+    return 0;
+  }
+  if(j_segm == NULL) {
+    fprintf(stderr, "Error: cegmentation file is not specified.\n");
+    return 1;
+  }
 
   cJSON* j_file_list = cJSON_GetObjectItem(j_segm, "file_list");
   checkvar(file_list);
   int nfile = cJSON_GetArraySize(j_file_list);
+  prune_summary prune_total = {0};
+  int ncached = 0;
+  if(opt_cachedir != NULL)
+    model_hash = hash_model(hsmm);
 
-  lrh_model_precompute(hsmm);
+  prof_stamp p = prof_start();
+  model_precompute(hsmm);
+  prof_stop(p, "precompute", -1, 0, 0);
+  if(opt_calibrate > 0) {
+    if(opt_geodur || ! opt_embdalign)
+      fprintf(stderr, "Warning: calibration applies to embedded HSMM "
+        "alignment; -g and -i are ignored.\n");
+    cJSON* j_calib = calibrate(hsmm, j_file_list);
+    char* jsonstr = cJSON_Print(j_calib);
+    printf("%s\n", jsonstr);
+    free(jsonstr);
+    cJSON_Delete(j_calib);
+    if(hsmm_coarse != NULL) delete_coarse_model(hsmm_coarse);
+    delete_gs_books(hsmm);
+    cJSON_Delete(j_segm);
+    delete_model(hsmm);
+    return 0;
+  }
+  if(opt_online) {
+#   ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#   endif
+    cJSON* j_states = cJSON_GetObjectItem(cJSON_GetArrayItem(j_file_list, 0),
+      "states");
+    checkvar(states);
+    align_online(hsmm, j_states);
+    if(hsmm_coarse != NULL) delete_coarse_model(hsmm_coarse);
+    delete_gs_books(hsmm);
+    cJSON_Delete(j_segm);
+    delete_model(hsmm);
+    return 0;
+  }
   for(int f = 0; f < nfile; f ++) {
     cJSON* j_file_list_f = cJSON_GetArrayItem(j_file_list, f);
     cJSON* j_filename = cJSON_GetObjectItem(j_file_list_f, "filename");
@@ -211,17 +1663,54 @@ int main(int argc, char** argv) {
     cJSON* j_states = cJSON_GetObjectItem(j_file_list_f, "states");
     checkvar(states);
 
+    uint64_t key = 0;
+    if(opt_cachedir != NULL) {
+      key = alignment_key(j_filename -> valuestring, j_states);
+      cJSON* j_cached = key == 0 ? NULL : cache_lookup(key);
+      if(j_cached != NULL) {
+        cJSON_ReplaceItemInObject(j_file_list_f, "states", j_cached);
+        ncached ++;
+        continue;
+      }
+    }
+
+    prof_file = f;
+    p = prof_start();
     lrh_observ* o = load_observ_from_float(j_filename -> valuestring, hsmm);
+    if(o == NULL) exit(1);
+    prof_stop(p, "load_observ", f, o -> nt, 0);
+    p = prof_start();
     j_states = align(hsmm, o, j_states);
+    prof_stop(p, "align", f, o -> nt, cJSON_GetArraySize(j_states));
     cJSON_ReplaceItemInObject(j_file_list_f, "states", j_states);
     lrh_delete_observ(o);
+    if(key != 0)
+      cache_store(key, j_states);
+    if(last_prune_valid) {
+      print_prune_stat(fp_prune, "", j_filename -> valuestring, last_prune);
+      add_prune_stat(& prune_total, last_prune);
+      last_prune_valid = 0;
+    }
+  }
+  prof_file = -1;
+  if(opt_cachedir != NULL)
+    fprintf(stderr, "Reused %d of %d cached alignments.\n", ncached, nfile);
+  if(fp_prune != NULL) {
+    print_prune_summary(& prune_total);
+    fclose(fp_prune);
   }
+  print_gs_verify_stat();
 
+  p = prof_start();
   char* jsonstr = cJSON_Print(j_segm);
   printf("%s\n", jsonstr);
   free(jsonstr);
+  prof_stop(p, "write_json", -1, 0, 0);
 
   cJSON_Delete(j_segm);
-  lrh_delete_model(hsmm);
+  if(hsmm_coarse != NULL) delete_coarse_model(hsmm_coarse);
+  delete_gs_books(hsmm);
+  delete_cmvn(feature_cmvn);
+  delete_model(hsmm);
   return 0;
 }
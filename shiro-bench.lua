@@ -0,0 +1,299 @@
+--[[
+  SHIRO
+  ===
+  Copyright (c) 2017-2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+]]
+
+local mypath = arg[0]:match("(.-)[^\\/]+$")
+if mypath == "" then
+  mypath = "./"
+end
+
+package.path = package.path .. ";" ..
+  mypath .. "?.lua;" .. mypath .. "external/?.lua"
+
+json = require("dkjson")
+getopt = require("getopt")
+shiro_cli = require("cli-common")
+
+opts = getopt(arg, "nljrswo")
+
+if opts.h then
+  print("Usage:")
+  print("shiro-bench.lua\n" ..
+        "  -n num-utterances -l utterance-length (in seconds)\n" ..
+        "  -j max-threads -r num-repeats -s random-seed\n" ..
+        "  -w work-directory -o output-file")
+  return
+end
+
+local num_utt = tonumber(opts.n or "20")
+local utt_length = tonumber(opts.l or "4")
+local num_repeat = tonumber(opts.r or "1")
+local seed = tonumber(opts.s or "1")
+local workdir = (opts.w or "./bench") .. "/"
+local output = opts.o or (workdir .. "result.json")
+local phoneset = mypath .. "examples/arpabet-phoneset.csv"
+
+local fs = 16000
+local nhop = 80
+local ndim = 36
+
+local function try_execute(str)
+  local ret = os.execute(str)
+  if ret ~= true and ret ~= 0 then
+    print("Error occurred when executing command " .. str)
+    os.exit(1)
+  end
+end
+
+local function read_command(str)
+  local fh = io.popen(str)
+  if fh == nil then return nil end
+  local ret = fh:read("*l")
+  fh:close()
+  return ret
+end
+
+local function fsize(path)
+  local fh = io.open(path, "rb")
+  if fh == nil then return 0 end
+  local size = fh:seek("end")
+  fh:close()
+  return size
+end
+
+local max_thread = tonumber(opts.j or read_command("nproc 2> /dev/null") or "1")
+if max_thread == nil or max_thread < 1 then max_thread = 1 end
+
+-- Park-Miller generator; exact in double precision, hence the same sequence
+--   on every platform and Lua version.
+local rand_state = seed % 2147483646 + 1
+local function rand()
+  rand_state = (rand_state * 16807) % 2147483647
+  return rand_state / 2147483647
+end
+
+-- IEEE 754 single precision, little endian (no string.pack in Lua 5.1).
+local function float_bytes(x)
+  if math.abs(x) < 1e-30 then return "\0\0\0\0" end
+  local sign = 0
+  if x < 0 then
+    sign = 128
+    x = -x
+  end
+  local e = math.floor(math.log(x) / math.log(2))
+  if 2 ^ e > x then e = e - 1 end
+  if 2 ^ (e + 1) <= x then e = e + 1 end
+  local m = math.floor((x / 2 ^ e - 1) * 8388608 + 0.5)
+  if m >= 8388608 then
+    m = 0
+    e = e + 1
+  end
+  e = e + 127
+  return string.char(m % 256, math.floor(m / 256) % 256,
+    math.floor(m / 65536) + (e % 2) * 128, sign + math.floor(e / 2))
+end
+
+-- GNU time gives the peak RSS of the child; otherwise only the wall time
+--   is measured.
+local has_gnu_time = os.execute(
+  "/usr/bin/time -f %M true > /dev/null 2>&1")
+has_gnu_time = has_gnu_time == true or has_gnu_time == 0
+
+local path_timing = workdir .. "timing.txt"
+local function run_timed(cmd, nthread)
+  local env = "OMP_NUM_THREADS=" .. nthread .. " "
+  local best = nil
+  for r = 1, num_repeat do
+    if has_gnu_time then
+      try_execute(env .. "/usr/bin/time -f \"%e %M\" -o " .. path_timing ..
+        " sh -c '" .. cmd .. "'")
+    else
+      try_execute("s=$(date +%s.%N); " .. env .. "sh -c '" .. cmd .. "'" ..
+        " && e=$(date +%s.%N) && echo \"$s $e\" > " .. path_timing)
+    end
+    local fh = io.open(path_timing, "r")
+    local a, b = fh:read("*n", "*n")
+    fh:close()
+    local result
+    if has_gnu_time then
+      result = {time = a, rss = b}
+    else
+      result = {time = b - a}
+    end
+    if best == nil or result.time < best.time then best = result end
+  end
+  return best
+end
+
+local thread_counts = {}
+local k = 1
+while k < max_thread do
+  thread_counts[#thread_counts + 1] = k
+  k = k * 2
+end
+thread_counts[#thread_counts + 1] = max_thread
+
+local report = {
+  config = {
+    num_utterances = num_utt,
+    utterance_length = utt_length,
+    seed = seed,
+    repeats = num_repeat,
+    max_threads = max_thread,
+    revision = read_command("git -C " .. mypath .. " rev-parse --short HEAD" ..
+      " 2> /dev/null"),
+    rss_available = has_gnu_time
+  },
+  results = {}
+}
+
+local total_frames = 0
+local function add_result(name, cmd, nthread, niter)
+  local t = run_timed(cmd, nthread)
+  local entry = {
+    name = name,
+    threads = nthread,
+    seconds = t.time,
+    frames_per_second = total_frames * (niter or 1) / t.time,
+    peak_rss_kb = t.rss
+  }
+  report.results[#report.results + 1] = entry
+  print(string.format("%-24s %3d thread(s) %9.3f s %12.1f frames/s",
+    name, nthread, t.time, entry.frames_per_second))
+  return entry
+end
+
+-- Runs cmd on every thread count and fills in the scaling efficiency
+--   relative to the single-threaded run.
+local function add_scaling(name, cmd, niter)
+  local base = nil
+  for _, n in ipairs(thread_counts) do
+    local entry = add_result(name, cmd, n, niter)
+    if base == nil then base = entry.seconds end
+    entry.speedup = base / entry.seconds
+    entry.efficiency = entry.speedup / n
+  end
+end
+
+try_execute("mkdir -p " .. workdir)
+
+-- Phoneme inventory.
+local phonemes = {}
+local fh = io.open(phoneset, "r")
+if fh == nil then
+  print("Error: cannot open " .. phoneset)
+  return
+end
+for line in fh:lines() do
+  local p = line:match("^(%S+)")
+  if p ~= nil and p ~= "sil" and p ~= "pau" then
+    phonemes[#phonemes + 1] = p
+  end
+end
+fh:close()
+
+-- Deterministic corpus: each phoneme is rendered as a few harmonics of a
+--   phoneme-dependent fundamental plus noise, so that the features (and hence
+--   the alignment workload) are not degenerate.
+local path_index = workdir .. "index.csv"
+local index = {}
+for i = 1, num_utt do
+  local name = string.format("bench%03d", i)
+  local seq = {}
+  local samples = {}
+  local nsample = math.floor(utt_length * fs)
+  local t = 0
+  while t < nsample do
+    local p = math.floor(rand() * #phonemes) + 1
+    local len = math.floor((0.05 + rand() * 0.1) * fs)
+    local f0 = 100 + p * 10
+    seq[#seq + 1] = phonemes[p]
+    for n = t, math.min(t + len, nsample) - 1 do
+      local x = (rand() - 0.5) * 0.05
+      for h = 1, 3 do
+        x = x + math.sin(2 * math.pi * f0 * h * n / fs) * 0.3 / h
+      end
+      samples[#samples + 1] = float_bytes(x)
+    end
+    t = t + len
+  end
+  local out = io.open(workdir .. name .. ".raw", "wb")
+  out:write(table.concat(samples))
+  out:close()
+  index[#index + 1] = name .. "," .. table.concat(seq, " ")
+end
+fh = io.open(path_index, "w")
+fh:write(table.concat(index, "\n") .. "\n")
+fh:close()
+
+try_execute("lua " .. mypath .. "shiro-mkpm.lua " .. phoneset ..
+  " -s 3 -S 3 > " .. workdir .. "phonemap.json")
+try_execute("lua " .. mypath .. "shiro-pm2md.lua " .. workdir ..
+  "phonemap.json -d 12 > " .. workdir .. "modeldef.json")
+try_execute(mypath .. "shiro-mkhsmm -c " .. workdir .. "modeldef.json > " ..
+  workdir .. "empty.hsmm")
+
+-- Feature extraction, timed over the whole corpus.
+local xxcc = {}
+for i = 1, num_utt do
+  local stem = workdir .. string.format("bench%03d", i)
+  xxcc[#xxcc + 1] = mypath .. "shiro-xxcc -l 512 -p " .. nhop ..
+    " -m 12 -s 16 -da " .. stem .. ".raw > " .. stem .. ".param"
+  total_frames = total_frames + math.floor(utt_length * fs / nhop)
+end
+add_result("shiro-xxcc", table.concat(xxcc, " && "), 1)
+
+total_frames = 0
+for i = 1, num_utt do
+  total_frames = total_frames + fsize(workdir ..
+    string.format("bench%03d", i) .. ".param") / ndim / 4
+end
+report.config.total_frames = total_frames
+
+try_execute(mypath .. "shiro-mkseg " .. path_index .. " -m " .. workdir ..
+  "phonemap.json -d " .. workdir .. " -e .param -n " .. ndim ..
+  " -L sil -R sil > " .. workdir .. "unaligned.json")
+
+local model = " -m " .. workdir
+local seg = " -s " .. workdir
+add_scaling("shiro-init", mypath .. "shiro-init" .. model .. "empty.hsmm" ..
+  seg .. "unaligned.json -FT > " .. workdir .. "flat.hsmm")
+add_scaling("shiro-rest (HMM)", mypath .. "shiro-rest" .. model ..
+  "flat.hsmm" .. seg .. "unaligned.json -n 1 -g -T > " .. workdir ..
+  "markovian.hsmm", 1)
+-- shiro-align processes the files one after another, so it is timed on a
+--   single thread only; more threads would merely speed up precomputation.
+add_result("shiro-align (HMM)", mypath .. "shiro-align" .. model ..
+  "markovian.hsmm" .. seg .. "unaligned.json -g > " .. workdir ..
+  "markovian.json", 1)
+add_scaling("shiro-rest (HSMM)", mypath .. "shiro-rest" .. model ..
+  "markovian.hsmm" .. seg .. "markovian.json -n 1 -p 10 -d 50 -T > " ..
+  workdir .. "trained.hsmm", 1)
+add_result("shiro-align (HSMM)", mypath .. "shiro-align" .. model ..
+  "trained.hsmm" .. seg .. "markovian.json -p 10 -d 50 > " .. workdir ..
+  "aligned.json", 1)
+
+fh = io.open(output, "w")
+fh:write(json.encode(report, {indent = true, keyorder = {
+  "config", "results", "name", "threads", "seconds", "frames_per_second",
+  "speedup", "efficiency", "peak_rss_kb"}}))
+fh:write("\n")
+fh:close()
+print("Results written to " .. output)
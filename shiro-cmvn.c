@@ -0,0 +1,230 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "external/cJSON/cJSON.h"
+#include "external/liblrhsmm/common.h"
+#include "external/liblrhsmm/serial.h"
+#include <omp.h>
+
+#include "cli-common.h"
+
+static void print_usage() {
+  fprintf(stderr,
+    "shiro-cmvn\n"
+    "  -s segmentation-file\n"
+    "  -n num-dimension (frame size of the feature files)\n"
+    "  -g normalization-mode (global/speaker/utterance, default: speaker)\n"
+    "  -T (enable multi-threading)\n"
+    "  -h (print usage)\n");
+  exit(1);
+}
+
+// first and second order sums, in double precision since a corpus easily
+//   exceeds the range where float accumulation is exact
+typedef struct {
+  char* name;
+  int ndim;
+  double n;
+  double* sum;
+  double* sum2;
+} cmvn_acc;
+
+typedef struct {
+  int ngroup;
+  int capacity;
+  cmvn_acc* groups;
+} cmvn_acc_list;
+
+static cmvn_acc* find_acc(cmvn_acc_list* l, const char* name, int namelen,
+  int ndim) {
+  for(int g = 0; g < l -> ngroup; g ++)
+    if((int)strlen(l -> groups[g].name) == namelen &&
+       ! strncmp(l -> groups[g].name, name, namelen))
+      return l -> groups + g;
+  if(l -> ngroup == l -> capacity) {
+    l -> capacity = l -> capacity * 2 + 4;
+    l -> groups = realloc(l -> groups, l -> capacity * sizeof(cmvn_acc));
+  }
+  cmvn_acc* ret = l -> groups + l -> ngroup ++;
+  ret -> name = calloc(namelen + 1, 1);
+  strncpy(ret -> name, name, namelen);
+  ret -> ndim = ndim;
+  ret -> n = 0;
+  ret -> sum = calloc(ndim, sizeof(double));
+  ret -> sum2 = calloc(ndim, sizeof(double));
+  return ret;
+}
+
+static void add_acc(cmvn_acc* dst, double n, double* sum, double* sum2) {
+  dst -> n += n;
+  for(int j = 0; j < dst -> ndim; j ++) {
+    dst -> sum[j] += sum[j];
+    dst -> sum2[j] += sum2[j];
+  }
+}
+
+static cJSON* json_from_acc(cmvn_acc* a) {
+  cJSON* j_group = cJSON_CreateObject();
+  cJSON* j_mean = cJSON_CreateArray();
+  cJSON* j_std = cJSON_CreateArray();
+  for(int j = 0; j < a -> ndim; j ++) {
+    double mean = a -> sum[j] / max(a -> n, 1);
+    double var = a -> sum2[j] / max(a -> n, 1) - mean * mean;
+    cJSON_AddItemToArray(j_mean, cJSON_CreateNumber(mean));
+    cJSON_AddItemToArray(j_std, cJSON_CreateNumber(sqrt(max(var, 1e-10))));
+  }
+  cJSON_AddItemToObject(j_group, "name", cJSON_CreateString(a -> name));
+  cJSON_AddItemToObject(j_group, "frames", cJSON_CreateNumber(a -> n));
+  cJSON_AddItemToObject(j_group, "mean", j_mean);
+  cJSON_AddItemToObject(j_group, "std", j_std);
+  return j_group;
+}
+
+extern char* optarg;
+int main(int argc, char** argv) {
+  int c;
+  cJSON* j_segm = NULL;
+
+  int opt_ndim = 0;
+  int opt_mode = CMVN_SPEAKER;
+  int opt_mthread = 0;
+  while((c = getopt(argc, argv, "s:n:g:Th")) != -1) {
+    char* jsonstr = NULL;
+    switch(c) {
+    case 's':
+      jsonstr = readall(optarg);
+      if(jsonstr == NULL) {
+        fprintf(stderr, "Error: cannot open %s.\n", optarg);
+        return 1;
+      }
+      j_segm = cJSON_Parse(jsonstr);
+      if(j_segm == NULL) {
+        fprintf(stderr, "Error: failed to parse %s.\n", optarg);
+        return 1;
+      }
+      free(jsonstr);
+    break;
+    case 'n':
+      opt_ndim = atoi(optarg);
+    break;
+    case 'g':
+      opt_mode = parse_cmvn_mode(optarg);
+      if(opt_mode < 0) {
+        fprintf(stderr, "Error: unknown normalization mode %s.\n", optarg);
+        return 1;
+      }
+    break;
+    case 'T':
+      opt_mthread = 1;
+    break;
+    case 'h':
+      print_usage();
+    break;
+    default:
+      abort();
+    }
+  }
+  if(j_segm == NULL) {
+    fprintf(stderr, "Error: segmentation file is not specified.\n");
+    return 1;
+  }
+  if(opt_ndim < 1) {
+    fprintf(stderr, "Error: feature dimension is not specified.\n");
+    return 1;
+  }
+# ifdef _OPENMP
+  if(opt_mthread == 0)
+    omp_set_num_threads(1);
+# endif
+
+  cJSON* j_file_list = cJSON_GetObjectItem(j_segm, "file_list");
+  checkvar(file_list);
+  int nfile = cJSON_GetArraySize(j_file_list);
+
+  // A single pass over the corpus; each file is summed on its own and merged
+  //   into the global and speaker accumulators.
+  cmvn_acc_list accs = {0, 0, NULL};
+  find_acc(& accs, "*", 1, opt_ndim);
+  int nfailed = 0;
+# pragma omp parallel for schedule(dynamic) reduction(+:nfailed)
+  for(int f = 0; f < nfile; f ++) {
+    cJSON* j_file_list_f = cJSON_GetArrayItem(j_file_list, f);
+    cJSON* j_filename = cJSON_GetObjectItem(j_file_list_f, "filename");
+    checkvar(filename);
+    const char* path = j_filename -> valuestring;
+    int nt = 0;
+    float* x = read_feature_file(path, opt_ndim, & nt);
+    if(x == NULL) {
+      fprintf(stderr, "Warning: cannot read %s or its size does not match "
+        "with the given dimension; skipped.\n", path);
+      nfailed ++;
+      continue;
+    }
+    double* sum = calloc(opt_ndim, sizeof(double));
+    double* sum2 = calloc(opt_ndim, sizeof(double));
+    for(int t = 0; t < nt; t ++)
+      for(int j = 0; j < opt_ndim; j ++) {
+        double v = x[t * opt_ndim + j];
+        sum[j] += v;
+        sum2[j] += v * v;
+      }
+#   pragma omp critical
+    {
+      add_acc(accs.groups, nt, sum, sum2);
+      if(opt_mode == CMVN_SPEAKER)
+        add_acc(find_acc(& accs, path, cmvn_speaker_length(path), opt_ndim),
+          nt, sum, sum2);
+    }
+    free(sum);
+    free(sum2);
+    free(x);
+  }
+
+  cJSON* j_out = cJSON_CreateObject();
+  const char* modes[] = {"global", "speaker", "utterance"};
+  cJSON_AddItemToObject(j_out, "mode", cJSON_CreateString(modes[opt_mode]));
+  cJSON_AddItemToObject(j_out, "ndim", cJSON_CreateNumber(opt_ndim));
+  cJSON* j_groups = cJSON_CreateArray();
+  for(int g = 0; g < accs.ngroup; g ++)
+    cJSON_AddItemToArray(j_groups, json_from_acc(accs.groups + g));
+  cJSON_AddItemToObject(j_out, "groups", j_groups);
+
+  char* strout = cJSON_Print(j_out);
+  printf("%s\n", strout);
+  free(strout);
+  fprintf(stderr, "Normalization statistics over %d files (%d skipped), "
+    "%d group(s), %.0f frames.\n", nfile - nfailed, nfailed, accs.ngroup,
+    accs.groups[0].n);
+
+  for(int g = 0; g < accs.ngroup; g ++) {
+    free(accs.groups[g].name);
+    free(accs.groups[g].sum);
+    free(accs.groups[g].sum2);
+  }
+  free(accs.groups);
+  cJSON_Delete(j_out);
+  cJSON_Delete(j_segm);
+  return 0;
+}
@@ -0,0 +1,186 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L // mkstemp
+#endif
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "external/cJSON/cJSON.h"
+#include "external/liblrhsmm/common.h"
+#include "external/liblrhsmm/serial.h"
+#include <omp.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "cli-common.h"
+
+static void print_usage() {
+  fprintf(stderr,
+    "shiro-conv\n"
+    "  -m model-file\n"
+    "  -b (output in native binary format)\n"
+    "  -B num-iteration (benchmark model load/save time)\n"
+    "  -h (print usage)\n");
+  exit(1);
+}
+
+static lrh_model* load_model_unbuffered(const char* path) {
+  FILE* fin = fopen(path, "rb");
+  if(fin == NULL) return NULL;
+  cmp_ctx_t cmpobj;
+  cmp_init(& cmpobj, fin, file_reader, file_writer);
+  lrh_model* h = lrh_read_model(& cmpobj);
+  fclose(fin);
+  return h;
+}
+
+static void benchmark_io(const char* path, lrh_model* h, int niter) {
+  double t_load[3] = {0, 0, 0};
+  double t_save[3] = {0, 0, 0};
+  for(int i = 0; i < niter; i ++) {
+    double t0 = omp_get_wtime();
+    delete_model(load_model_unbuffered(path));
+    double t1 = omp_get_wtime();
+    delete_model(load_model(path));
+    double t2 = omp_get_wtime();
+    t_load[0] += t1 - t0;
+    t_load[1] += t2 - t1;
+
+    FILE* ftmp = tmpfile();
+    cmp_ctx_t cmpobj;
+    cmp_init(& cmpobj, ftmp, file_reader, file_writer);
+    t0 = omp_get_wtime();
+    lrh_write_model(& cmpobj, h);
+    fflush(ftmp);
+    t1 = omp_get_wtime();
+    rewind(ftmp);
+    write_model(ftmp, h);
+    t2 = omp_get_wtime();
+    rewind(ftmp);
+    write_model_bin(ftmp, h);
+    double t3 = omp_get_wtime();
+    fclose(ftmp);
+    t_save[0] += t1 - t0;
+    t_save[1] += t2 - t1;
+    t_save[2] += t3 - t2;
+  }
+
+  // mapped load from a temporary binary copy, created under $TMPDIR with a
+  //   unique name so that concurrent runs do not collide
+  FILE* fbin = NULL;
+# ifdef _WIN32
+  char* path_bin = _tempnam(NULL, "shiro");
+  if(path_bin != NULL)
+    fbin = fopen(path_bin, "wb");
+# else
+  const char* tmpdir = getenv("TMPDIR");
+  if(tmpdir == NULL || tmpdir[0] == 0) tmpdir = "/tmp";
+  char* path_bin = malloc(strlen(tmpdir) + 32);
+  sprintf(path_bin, "%s/shiro-conv-XXXXXX", tmpdir);
+  int fd = mkstemp(path_bin);
+  if(fd >= 0)
+    fbin = fdopen(fd, "wb");
+# endif
+  int has_bin = fbin != NULL;
+  if(! has_bin)
+    fprintf(stderr, "Warning: cannot create a temporary file; skipping the "
+      "mapped load of the binary format.\n");
+  else {
+    write_model_bin(fbin, h);
+    fclose(fbin);
+    for(int i = 0; i < niter; i ++) {
+      double t0 = omp_get_wtime();
+      delete_model(load_model(path_bin));
+      t_load[2] += omp_get_wtime() - t0;
+    }
+    remove(path_bin);
+  }
+  free(path_bin);
+
+  const char* names[3] = {"cmp (unbuffered)", "cmp (buffered)", "binary"};
+  fprintf(stderr, "%-20s %12s %12s\n", "format", "load (ms)", "save (ms)");
+  for(int i = 0; i < 3; i ++)
+    if(i == 2 && ! has_bin) // mapped load not measured
+      fprintf(stderr, "%-20s %12s %12.3f\n", names[i], "-",
+        t_save[i] / niter * 1000.0);
+    else
+      fprintf(stderr, "%-20s %12.3f %12.3f\n", names[i],
+        t_load[i] / niter * 1000.0, t_save[i] / niter * 1000.0);
+}
+
+extern char* optarg;
+int main(int argc, char** argv) {
+# ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+# endif
+  int c;
+  lrh_model* hsmm = NULL;
+
+  int opt_binary = 0;
+  int opt_benchmark = 0;
+  char* path_model = NULL;
+  while((c = getopt(argc, argv, "m:bB:h")) != -1) {
+    switch(c) {
+    case 'm':
+      path_model = optarg;
+      hsmm = load_model(optarg);
+      if(hsmm == NULL) {
+        fprintf(stderr, "Error: failed to load model from %s\n", optarg);
+        return 1;
+      }
+    break;
+    case 'b':
+      opt_binary = 1;
+    break;
+    case 'B':
+      opt_benchmark = atoi(optarg);
+    break;
+    case 'h':
+      print_usage();
+    break;
+    default:
+      abort();
+    }
+  }
+  if(hsmm == NULL) {
+    fprintf(stderr, "Error: model file is not specified.\n");
+    return 1;
+  }
+
+  if(opt_benchmark > 0) {
+    if(! strcmp(path_model, "-") || is_binmodel(path_model)) {
+      fprintf(stderr, "Error: benchmarking requires a MessagePack model file.\n");
+      return 1;
+    }
+    benchmark_io(path_model, hsmm, opt_benchmark);
+  } else if(opt_binary)
+    write_model_bin(stdout, hsmm);
+  else
+    write_model(stdout, hsmm);
+
+  delete_model(hsmm);
+  return 0;
+}
@@ -35,36 +35,64 @@ if detect_os() == "Windows" and mypath == "./" then
   mypath = ""
 end
 
-opts = getopt(arg, "dexrD")
+opts = getopt(arg, "dexrDjR")
 
 if opts.h then
   print("Usage:")
   print("shiro-fextr.lua path-to-index-file\n" ..
         "  -d input-directory -e input-extension -x feature-extractor\n" ..
-        "  -n (normalize) -D dither-level -r forced-sample-rate")
+        "  -n (normalize) -D dither-level -r forced-sample-rate\n" ..
+        "  -R resampling-method (ciglet/polyphase/polyphase-fast)\n" ..
+        "  -j num-jobs -f (re-extract up-to-date files)")
   return
 end
 
 local input_index = opts._[1]
 local opt_directory = (opts.d or ".") .. "/"
 local opt_forced_samplerate = opts.r or 0
+local opt_resampler = opts.R
 local opt_extension = opts.e or ".wav"
 local opt_normalize = opts.n or false
 local opt_dithering = tonumber(opts.D or "0")
+local opt_njob = tonumber(opts.j or "1")
+local opt_force = opts.f or false
 local opt_fextract = mypath .. "extractors/extractor-xxcc-mfcc12-da-16k"
 if opts.x ~= nil then opt_fextract = opts.x end
 
-local fextract = loadfile(opt_fextract .. ".lua")()
+-- An extractor is either a function extracting one entry, or a table with
+--   such a function (extract) and optionally one that extracts a list of
+--   entries in a single command (batch).
+local extractor = loadfile(opt_fextract .. ".lua")()
+local fextract, fextract_batch = extractor, nil
+if type(extractor) == "table" then
+  fextract = extractor.extract
+  fextract_batch = extractor.batch
+end
+local is_windows = detect_os() == "Windows"
 
 if input_index == nil then
   print("Error: shiro-fextr requires an input index file.")
   return
 end
+if opt_njob == nil or opt_njob < 1 then
+  print("Error: invalid number of jobs.")
+  return
+end
+if is_windows and opt_njob > 1 then
+  print("Warning: parallel extraction is not supported on Windows; " ..
+        "falling back to a single job.")
+  opt_njob = 1
+end
 
 -- read and parse index file
 file_list = shiro_cli.load_index_file(input_index, opt_directory, {}, {})
 if file_list == false then return end
 
+local function execute_ok(str)
+  local ret = os.execute(str)
+  return ret == true or ret == 0
+end
+
 function try_execute(str)
   local ret = os.execute(str)
   --print(str)
@@ -74,22 +102,162 @@ function try_execute(str)
   end
 end
 
-for i, entry in ipairs(file_list) do
-  local infile = entry.path .. opt_extension
-  print("Processing " .. infile)
+local function wall_time()
+  if not is_windows then
+    local fh = io.popen("date +%s.%N 2> /dev/null")
+    local t = tonumber(fh:read("*l") or "")
+    fh:close()
+    if t ~= nil then return t end
+  end
+  return os.time()
+end
 
-  local rawfile = entry.path .. ".raw"
-  local cmd_wav2raw = "shiro-wav2raw"
-  if opt_normalize then
-    cmd_wav2raw = cmd_wav2raw .. " -N"
+local function fsize(path)
+  local fh = io.open(path, "rb")
+  if fh == nil then return 0 end
+  local size = fh:seek("end")
+  fh:close()
+  return size
+end
+
+-- Entries whose .param is newer than the input are skipped. The test for the
+--   whole list is a single shell script rather than one process per file.
+--   A .param.partial marker exists for as long as an entry is being extracted,
+--   so that the output of an interrupted run is never taken as up to date.
+local pending = {}
+if opt_force or is_windows then
+  pending = file_list
+else
+  local path_check = os.tmpname()
+  local fh = io.open(path_check, "w")
+  for i, entry in ipairs(file_list) do
+    fh:write("[ \"" .. entry.path .. ".param\" -nt \"" .. entry.path ..
+      opt_extension .. "\" ] && [ ! -e \"" .. entry.path ..
+      ".param.partial\" ] && echo " .. i .. "\n")
+  end
+  fh:close()
+  local uptodate = {}
+  fh = io.popen("sh \"" .. path_check .. "\"")
+  for line in fh:lines() do
+    uptodate[tonumber(line)] = true
+  end
+  fh:close()
+  os.remove(path_check)
+  for i, entry in ipairs(file_list) do
+    if not uptodate[i] then pending[#pending + 1] = entry end
   end
-  cmd_wav2raw = cmd_wav2raw .. " -d " .. opt_dithering
-  if opt_forced_samplerate == 0 then
-    try_execute(mypath .. cmd_wav2raw .. " \"" .. infile .. "\"")
+  if #pending < #file_list then
+    print("Skipping " .. (#file_list - #pending) .. " up-to-date file(s).")
+  end
+end
+
+local cmd_wav2raw = mypath .. "shiro-wav2raw"
+if opt_normalize then
+  cmd_wav2raw = cmd_wav2raw .. " -N"
+end
+cmd_wav2raw = cmd_wav2raw .. " -d " .. opt_dithering
+if opt_forced_samplerate ~= 0 then
+  cmd_wav2raw = cmd_wav2raw .. " -r " .. opt_forced_samplerate
+end
+if opt_resampler ~= nil then
+  cmd_wav2raw = cmd_wav2raw .. " -R " .. opt_resampler
+end
+
+-- Entries are processed in batches; extractors without a batch form take
+--   one entry per batch. With several jobs the batches are made small enough
+--   to keep every job busy.
+local max_batch = 256
+local batch_size = 1
+if fextract_batch ~= nil then
+  batch_size = math.max(1, math.min(max_batch,
+    math.ceil(#pending / opt_njob)))
+end
+local batches = {}
+for i, entry in ipairs(pending) do
+  if (i - 1) % batch_size == 0 then batches[#batches + 1] = {} end
+  local batch = batches[#batches]
+  batch[#batch + 1] = entry
+end
+
+-- Runs the extractor on a batch through run, which executes or records a
+--   command.
+local function extract_batch(run, batch)
+  if fextract_batch ~= nil then
+    local rawfiles = {}
+    for i, entry in ipairs(batch) do rawfiles[i] = entry.path .. ".raw" end
+    fextract_batch(run, rawfiles, mypath)
   else
-    try_execute(mypath .. cmd_wav2raw .. " -r " .. opt_forced_samplerate ..
-      " \"" .. infile .. "\"")
+    for i, entry in ipairs(batch) do
+      fextract(run, entry.path, entry.path .. ".raw", mypath)
+    end
+  end
+end
+
+local time_start = wall_time()
+local input_bytes = 0
+
+if opt_njob == 1 then
+  for b, batch in ipairs(batches) do
+    for i, entry in ipairs(batch) do
+      local infile = entry.path .. opt_extension
+      print("Processing " .. infile)
+      input_bytes = input_bytes + fsize(infile)
+
+      io.open(entry.path .. ".param.partial", "w"):close()
+      try_execute(cmd_wav2raw .. " \"" .. infile .. "\"")
+    end
+    extract_batch(try_execute, batch)
+    for i, entry in ipairs(batch) do
+      os.remove(entry.path .. ".param.partial")
+    end
   end
+else
+  -- The extractor is run once per batch with try_execute replaced by a
+  --   recorder, which turns its commands into a job script; xargs then keeps
+  --   opt_njob scripts running at a time.
+  local jobdir = os.tmpname() .. ".jobs"
+  try_execute("mkdir -p \"" .. jobdir .. "\"")
+  local path_joblist = jobdir .. "/jobs.txt"
+  local joblist = io.open(path_joblist, "w")
+  local saved_try_execute = try_execute
+  for b, batch in ipairs(batches) do
+    local cmds = {"set -e"}
+    local markers = {}
+    for i, entry in ipairs(batch) do
+      local infile = entry.path .. opt_extension
+      input_bytes = input_bytes + fsize(infile)
+
+      local marker = "\"" .. entry.path .. ".param.partial\""
+      markers[#markers + 1] = marker
+      cmds[#cmds + 1] = "echo \"Processing " .. infile .. "\""
+      cmds[#cmds + 1] = "touch " .. marker
+      cmds[#cmds + 1] = cmd_wav2raw .. " \"" .. infile .. "\""
+    end
+    local recorder = function (str) cmds[#cmds + 1] = str end
+    try_execute = recorder -- some extractors use the global
+    extract_batch(recorder, batch)
+    try_execute = saved_try_execute
+    for i, marker in ipairs(markers) do
+      cmds[#cmds + 1] = "rm -f " .. marker
+    end
 
-  fextract(try_execute, entry.path, rawfile, mypath)
+    local path_job = jobdir .. "/" .. b .. ".sh"
+    local fh = io.open(path_job, "w")
+    fh:write(table.concat(cmds, "\n") .. "\n")
+    fh:close()
+    joblist:write(path_job .. "\n")
+  end
+  joblist:close()
+  local ok = execute_ok("xargs -P " .. opt_njob .. " -n 1 sh < \"" ..
+    path_joblist .. "\"")
+  try_execute("rm -rf \"" .. jobdir .. "\"")
+  if not ok then
+    print("Error: one or more extraction jobs failed.")
+    os.exit(1)
+  end
 end
+
+local elapsed = math.max(wall_time() - time_start, 1e-3)
+print(string.format("Processed %d file(s) (%.1f MB) in %.1f s: " ..
+  "%.2f files/s, %.2f MB/s.", #pending, input_bytes / 1048576, elapsed,
+  #pending / elapsed, input_bytes / 1048576 / elapsed))
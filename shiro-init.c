@@ -43,6 +43,7 @@ static void print_usage() {
     "  -v variance-floor\n"
     "  -F (flat start, i.e., starting from uniform state duration)\n"
     "  -T (globally tied flat start)\n"
+    "  -N normalization-statistics-file (from shiro-cmvn)\n"
     "  -h (print usage)\n");
   exit(1);
 }
@@ -62,7 +63,7 @@ static void collapse_output_states(lrh_seg* s) {
 static void duplicate_zeroth_state(lrh_model* h) {
   for(int l = 0; l < h -> nstream; l ++)
     for(int i = 1; i < h -> streams[l] -> ngmm; i ++) {
-      lrh_delete_gmm(h -> streams[l] -> gmms[i]);
+      delete_gmm(h -> streams[l] -> gmms[i]);
       h -> streams[l] -> gmms[i] = lrh_gmm_copy(h -> streams[l] -> gmms[0]);
     }
 }
@@ -100,11 +101,14 @@ int main(int argc, char** argv) {
   int opt_flatstart = 0;
   int opt_globltied = 0;
   FP_TYPE opt_variancefloor = 0.1;
-  while((c = getopt(argc, argv, "m:s:v:FTh")) != -1) {
+  prof_init("shiro-init");
+  while((c = getopt(argc, argv, "m:s:v:N:FTh")) != -1) {
     char* jsonstr = NULL;
+    prof_stamp p = prof_start();
     switch(c) {
     case 'm':
       hsmm = load_model(optarg);
+      prof_stop(p, "load_model", -1, 0, 0);
       if(hsmm == NULL) {
         fprintf(stderr, "Error: failed to load model from %s\n", optarg);
         return 1;
@@ -122,6 +126,7 @@ int main(int argc, char** argv) {
         return 1;
       }
       free(jsonstr);
+      prof_stop(p, "parse_json", -1, 0, 0);
     break;
     case 'v':
       opt_variancefloor = atof(optarg);
@@ -132,6 +137,14 @@ int main(int argc, char** argv) {
     case 'T':
       opt_globltied = 1;
     break;
+    case 'N':
+      feature_cmvn = load_cmvn(optarg);
+      if(feature_cmvn == NULL) {
+        fprintf(stderr, "Error: failed to load normalization statistics from "
+          "%s.\n", optarg);
+        return 1;
+      }
+    break;
     case 'h':
       print_usage();
     break;
@@ -152,7 +165,7 @@ int main(int argc, char** argv) {
   checkvar(file_list);
   int nfile = cJSON_GetArraySize(j_file_list);
 
-  lrh_model_stat* hstat = lrh_model_stat_from_model(hsmm);
+  lrh_model_stat* hstat = model_stat_from_model(hsmm);
   
   uint64_t total_frames = 0;
   uint64_t total_num_states = 0;
@@ -164,11 +177,16 @@ int main(int argc, char** argv) {
     cJSON* j_states = cJSON_GetObjectItem(j_file_list_f, "states");
     checkvar(states);
 
+    prof_stamp p = prof_start();
     lrh_observ* o = load_observ_from_float(j_filename -> valuestring, hsmm);
+    if(o == NULL) exit(1);
+    prof_stop(p, "load_observ", f, o -> nt, 0);
+    p = prof_start();
     lrh_seg* s = load_seg_from_json(j_states, hsmm -> nstream);
     for(int i = 0; i < s -> nseg; i ++)
       if(s -> time[i] > o -> nt)
         s -> time[i] = o -> nt;
+    prof_stop(p, "load_seg", f, 0, s -> nseg);
     
     total_frames += o -> nt;
     total_num_states = s -> nseg;
@@ -178,13 +196,17 @@ int main(int argc, char** argv) {
     if(opt_globltied)
       collapse_output_states(s); // all stats go into gmms[0]
 
+    p = prof_start();
     lrh_collect_init(hstat, o, s);
+    prof_stop(p, "collect", f, o -> nt, s -> nseg);
 
     lrh_delete_seg(s);
     lrh_delete_observ(o);
   }
 
-  lrh_model_update(hsmm, hstat, 0);
+  prof_stamp p = prof_start();
+  model_update(hsmm, hstat, 0);
+  prof_stop(p, "update", -1, 0, 0);
 
   if(opt_globltied)
     duplicate_zeroth_state(hsmm);
@@ -192,12 +214,13 @@ int main(int argc, char** argv) {
   FP_TYPE avg_dur = (FP_TYPE)total_frames / total_num_states;
   set_variance_floor(hsmm, opt_variancefloor, avg_dur);
 
-  cmp_ctx_t cmpobj;
-  cmp_init(& cmpobj, stdout, file_reader, file_writer);
-  lrh_write_model(& cmpobj, hsmm);
+  p = prof_start();
+  write_model(stdout, hsmm);
+  prof_stop(p, "write_model", -1, 0, 0);
 
   cJSON_Delete(j_segm);
   lrh_delete_model_stat(hstat);
-  lrh_delete_model(hsmm);
+  delete_cmvn(feature_cmvn);
+  delete_model(hsmm);
   return 0;
 }
@@ -0,0 +1,264 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "external/cJSON/cJSON.h"
+#include "external/liblrhsmm/common.h"
+#include "external/liblrhsmm/serial.h"
+#include <omp.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "cli-common.h"
+
+static void print_usage() {
+  fprintf(stderr,
+    "shiro-lab2seg path-to-index-file\n"
+    "  -m path-to-phonemap\n"
+    "  -d label-directory\n"
+    "  -t hop-time (in seconds, default 0.01)\n"
+    "  -e label-extension (default .txt)\n"
+    "  -E feature-extension (default .f)\n"
+    "  -T (enable multi-threading)\n"
+    "  -h (print usage)\n");
+  exit(1);
+}
+
+// index lines read ahead and converted in parallel
+#define LAB2SEG_BATCH 256
+
+// strip the trailing newline (and carriage return) of a line in place
+static int chomp(char* line) {
+  int len = strlen(line);
+  while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    line[-- len] = 0;
+  return len;
+}
+
+// builds the segmentation entry of one labeled file; NULL on error
+static cJSON* lab2seg(cJSON* j_phone_map, const char* label_path,
+  const char* feature_path, double hop_time) {
+  FILE* fin = fopen(label_path, "r");
+  if(fin == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", label_path);
+    return NULL;
+  }
+  cJSON* j_states = cJSON_CreateArray();
+  char delim = '\t';
+  int nline = 0;
+  char* line = NULL;
+  while((line = read_line(fin)) != NULL) {
+    chomp(line);
+    // space-separated if the first line has no tab; like parse_lab in
+    //   cli-common.lua
+    if(nline ++ == 0 && strchr(line, '\t') == NULL) delim = ' ';
+    int ntoken = 0;
+    char** tokens = delimit(line, delim, & ntoken);
+    free(line);
+    if(ntoken < 2) {
+      free_tokens(tokens, ntoken);
+      break;
+    }
+    double t0 = atof(tokens[0]);
+    double t1 = atof(tokens[1]);
+    const char* p = ntoken > 2 ? tokens[2] : "";
+    cJSON* j_pst = cJSON_GetObjectItem(j_phone_map, p);
+    if(j_pst == NULL) {
+      fprintf(stderr, "Error: phoneme %s is not defined in the phone map.\n",
+        p);
+      free_tokens(tokens, ntoken);
+      cJSON_Delete(j_states);
+      fclose(fin);
+      return NULL;
+    }
+    cJSON* j_pst_states = cJSON_GetObjectItem(j_pst, "states");
+    int nst = cJSON_GetArraySize(j_pst_states);
+    for(int k = 0; k < nst; k ++) {
+      cJSON* j_src = cJSON_GetArrayItem(j_pst_states, k);
+      cJSON* j_st = cJSON_CreateObject();
+      cJSON_AddNumberToObject(j_st, "time",
+        ceil((t0 + (t1 - t0) * (k + 1) / nst) / hop_time));
+      cJSON_AddNumberToObject(j_st, "dur",
+        cJSON_GetObjectItem(j_src, "dur") -> valueint);
+      cJSON_AddItemToObject(j_st, "out",
+        cJSON_Duplicate(cJSON_GetObjectItem(j_src, "out"), 1));
+      cJSON_AddItemToObject(j_st, "jmp", cJSON_CreateArray());
+      cJSON* j_ext = cJSON_CreateArray();
+      cJSON_AddItemToArray(j_ext, cJSON_CreateString(p));
+      cJSON_AddItemToArray(j_ext, cJSON_CreateNumber(k));
+      cJSON_AddItemToObject(j_st, "ext", j_ext);
+      cJSON_AddItemToArray(j_states, j_st);
+    }
+    free_tokens(tokens, ntoken);
+  }
+  fclose(fin);
+
+  cJSON* j_entry = cJSON_CreateObject();
+  cJSON_AddStringToObject(j_entry, "filename", feature_path);
+  cJSON_AddItemToObject(j_entry, "states", j_states);
+  return j_entry;
+}
+
+extern char* optarg;
+int main(int argc, char** argv) {
+# ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+# endif
+  int c;
+  cJSON* j_pm = NULL;
+  const char* opt_directory = ".";
+  const char* opt_extension = ".txt";
+  const char* opt_featureext = ".f";
+  double opt_hoptime = 0.01;
+  int opt_mthread = 0;
+
+  while((c = getopt(argc, argv, "m:d:t:e:E:Th")) != -1) {
+    char* jsonstr = NULL;
+    switch(c) {
+    case 'm':
+      jsonstr = readall(optarg);
+      if(jsonstr == NULL) {
+        fprintf(stderr, "Error: cannot open %s.\n", optarg);
+        return 1;
+      }
+      j_pm = cJSON_Parse(jsonstr);
+      if(j_pm == NULL) {
+        fprintf(stderr, "Error: failed to parse %s.\n", optarg);
+        return 1;
+      }
+      free(jsonstr);
+    break;
+    case 'd':
+      opt_directory = optarg;
+    break;
+    case 't':
+      opt_hoptime = atof(optarg);
+      if(opt_hoptime <= 0) {
+        fprintf(stderr, "Error: invalid hop time.\n");
+        return 1;
+      }
+    break;
+    case 'e':
+      opt_extension = optarg;
+    break;
+    case 'E':
+      opt_featureext = optarg;
+    break;
+    case 'T':
+      opt_mthread = 1;
+    break;
+    case 'h':
+      print_usage();
+    break;
+    default:
+      abort();
+    }
+  }
+  if(j_pm == NULL) {
+    fprintf(stderr, "Error: shiro-lab2seg requires an input phonemap.\n");
+    return 1;
+  }
+  if(optind >= argc) {
+    fprintf(stderr, "Error: shiro-lab2seg requires an input index file.\n");
+    return 1;
+  }
+# ifdef _OPENMP
+  if(opt_mthread == 0)
+    omp_set_num_threads(1);
+# endif
+  checkpm(j_pm);
+  cJSON* j_phone_map = cJSON_GetObjectItem(j_pm, "phone_map");
+
+  FILE* fin = fopen(argv[optind], "r");
+  if(fin == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", argv[optind]);
+    return 1;
+  }
+
+  // The index is read in batches; the entries of a batch are converted in
+  //   parallel and written out in order before the next batch is read.
+  printf("{\n\t\"file_list\":\t[");
+  char* names[LAB2SEG_BATCH];
+  char* entries[LAB2SEG_BATCH];
+  int nline = 0, nentry = 0, eof = 0;
+  while(! eof) {
+    int n = 0;
+    while(n < LAB2SEG_BATCH) {
+      char* line = read_line(fin);
+      if(line == NULL || chomp(line) == 0) {
+        free(line);
+        eof = 1;
+        break;
+      }
+      nline ++;
+      int nparts = 0;
+      char** parts = delimit(line, ',', & nparts);
+      free(line);
+      if(nparts != 2) {
+        fprintf(stderr, "Error: format error at line %d.\n", nline);
+        return 1;
+      }
+      names[n] = malloc(strlen(opt_directory) + strlen(parts[0]) + 2);
+      sprintf(names[n], "%s/%s", opt_directory, parts[0]);
+      free_tokens(parts, nparts);
+      n ++;
+    }
+
+    int nfailed = 0;
+#   pragma omp parallel for schedule(dynamic) reduction(+:nfailed)
+    for(int i = 0; i < n; i ++) {
+      char* label_path = malloc(strlen(names[i]) + strlen(opt_extension) + 1);
+      char* feature_path = malloc(strlen(names[i]) +
+        strlen(opt_featureext) + 1);
+      sprintf(label_path, "%s%s", names[i], opt_extension);
+      sprintf(feature_path, "%s%s", names[i], opt_featureext);
+      cJSON* j_entry = lab2seg(j_phone_map, label_path, feature_path,
+        opt_hoptime);
+      entries[i] = NULL;
+      if(j_entry == NULL)
+        nfailed ++;
+      else {
+        entries[i] = cJSON_Print(j_entry);
+        cJSON_Delete(j_entry);
+      }
+      free(label_path);
+      free(feature_path);
+    }
+    if(nfailed > 0) return 1;
+
+    for(int i = 0; i < n; i ++) {
+      printf("%s%s", nentry ++ > 0 ? ", " : "", entries[i]);
+      free(entries[i]);
+      free(names[i]);
+    }
+  }
+  printf("]\n}\n");
+  fclose(fin);
+
+  cJSON_Delete(j_pm);
+  return 0;
+}
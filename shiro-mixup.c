@@ -0,0 +1,157 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "external/cJSON/cJSON.h"
+#include "external/liblrhsmm/common.h"
+#include "external/liblrhsmm/serial.h"
+#include <omp.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "cli-common.h"
+
+static void print_usage() {
+  fprintf(stderr,
+    "shiro-mixup\n"
+    "  -m model-file\n"
+    "  -n num-mixture (after splitting)\n"
+    "  -f perturbation-factor (in standard deviations, default 0.2)\n"
+    "  -s stream-index (default: all streams)\n"
+    "  -T (enable multi-threading)\n"
+    "  -h (print usage)\n");
+  exit(1);
+}
+
+// grow g to nmix mixtures by repeatedly splitting the heaviest mixture into
+//   two halves with means moved apart by +/- factor standard deviations
+static lrh_gmm* split_gmm(lrh_gmm* g, int nmix, FP_TYPE factor) {
+  lrh_gmm* ret = lrh_create_gmm(nmix, g -> ndim);
+  for(int k = 0; k < g -> nmix; k ++) {
+    ret -> weight[k] = g -> weight[k];
+    for(int j = 0; j < g -> ndim; j ++) {
+      lrh_gmmu(ret, k, j) = lrh_gmmu(g, k, j);
+      lrh_gmmv(ret, k, j) = lrh_gmmv(g, k, j);
+      lrh_gmmvf(ret, k, j) = lrh_gmmvf(g, k, j);
+    }
+  }
+  for(int n = g -> nmix; n < nmix; n ++) {
+    int k = 0;
+    for(int i = 1; i < n; i ++)
+      if(ret -> weight[i] > ret -> weight[k])
+        k = i;
+    ret -> weight[k] /= 2.0;
+    ret -> weight[n] = ret -> weight[k];
+    for(int j = 0; j < g -> ndim; j ++) {
+      FP_TYPE delta = factor * sqrt(lrh_gmmv(ret, k, j));
+      lrh_gmmu(ret, n, j) = lrh_gmmu(ret, k, j) + delta;
+      lrh_gmmu(ret, k, j) -= delta;
+      lrh_gmmv(ret, n, j) = lrh_gmmv(ret, k, j);
+      lrh_gmmvf(ret, n, j) = lrh_gmmvf(ret, k, j);
+    }
+  }
+  return ret;
+}
+
+extern char* optarg;
+int main(int argc, char** argv) {
+# ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+# endif
+  int c;
+  lrh_model* hsmm = NULL;
+
+  int opt_nmix = 0;
+  int opt_stream = -1;
+  int opt_mthread = 0;
+  FP_TYPE opt_factor = 0.2;
+  while((c = getopt(argc, argv, "m:n:f:s:Th")) != -1) {
+    switch(c) {
+    case 'm':
+      hsmm = load_model(optarg);
+      if(hsmm == NULL) {
+        fprintf(stderr, "Error: failed to load model from %s\n", optarg);
+        return 1;
+      }
+    break;
+    case 'n':
+      opt_nmix = atoi(optarg);
+    break;
+    case 'f':
+      opt_factor = atof(optarg);
+    break;
+    case 's':
+      opt_stream = atoi(optarg);
+    break;
+    case 'T':
+      opt_mthread = 1;
+    break;
+    case 'h':
+      print_usage();
+    break;
+    default:
+      abort();
+    }
+  }
+  if(hsmm == NULL) {
+    fprintf(stderr, "Error: model file is not specified.\n");
+    return 1;
+  }
+  if(opt_nmix < 1) {
+    fprintf(stderr, "Error: number of mixtures is not specified.\n");
+    return 1;
+  }
+  if(opt_stream >= hsmm -> nstream) {
+    fprintf(stderr, "Error: stream index out of range.\n");
+    return 1;
+  }
+# ifdef _OPENMP
+  if(opt_mthread == 0)
+    omp_set_num_threads(1);
+# endif
+
+  int nsplit = 0;
+  for(int l = 0; l < hsmm -> nstream; l ++) {
+    if(opt_stream >= 0 && l != opt_stream) continue;
+    lrh_stream* st = hsmm -> streams[l];
+#   pragma omp parallel for schedule(dynamic, 64) reduction(+:nsplit)
+    for(int i = 0; i < st -> ngmm; i ++) {
+      lrh_gmm* g = st -> gmms[i];
+      if(g -> nmix >= opt_nmix) continue;
+      st -> gmms[i] = split_gmm(g, opt_nmix, opt_factor);
+      delete_gmm(g);
+      nsplit ++;
+    }
+  }
+  fprintf(stderr, "Split %d output states into %d mixtures.\n", nsplit,
+    opt_nmix);
+
+  write_model(stdout, hsmm);
+
+  delete_model(hsmm);
+  return 0;
+}
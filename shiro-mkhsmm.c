@@ -125,9 +125,7 @@ int main(int argc, char** argv) {
     }
   }
 
-  cmp_ctx_t cmpobj;
-  cmp_init(& cmpobj, stdout, file_reader, file_writer);
-  lrh_write_model(& cmpobj, hsmm);
+  write_model(stdout, hsmm);
 
   lrh_delete_model(hsmm);
 
@@ -0,0 +1,271 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "external/cJSON/cJSON.h"
+#include "external/liblrhsmm/common.h"
+#include "external/liblrhsmm/serial.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "cli-common.h"
+
+static void print_usage() {
+  fprintf(stderr,
+    "shiro-mkseg path-to-index-file\n"
+    "  -m path-to-phonemap\n"
+    "  -d feature-directory\n"
+    "  -e feature-extension\n"
+    "  -n frame-size\n"
+    "  -L pad-phoneme-left\n"
+    "  -R pad-phoneme-right\n"
+    "  -h (print usage)\n");
+  exit(1);
+}
+
+static void add_jump(cJSON* j_state, int d, cJSON* j_p) {
+  if(j_state == NULL) return;
+  cJSON* j_jmp = cJSON_CreateObject();
+  cJSON_AddNumberToObject(j_jmp, "d", d);
+  if(j_p != NULL)
+    cJSON_AddNumberToObject(j_jmp, "p", j_p -> valuedouble);
+  cJSON_AddItemToArray(cJSON_GetObjectItem(j_state, "jmp"), j_jmp);
+}
+
+static cJSON* make_states(cJSON* j_phone_map, char** phonemes, int nphoneme,
+  long nfrm) {
+  // first pass: count states so that they can be indexed from the back
+  int nstate = 0;
+  for(int j = 0; j < nphoneme; j ++) {
+    cJSON* j_pst = cJSON_GetObjectItem(j_phone_map, phonemes[j]);
+    if(j_pst == NULL) {
+      fprintf(stderr, "Error: phoneme %s is not defined in the phone map.\n",
+        phonemes[j]);
+      exit(1);
+    }
+    nstate += cJSON_GetArraySize(cJSON_GetObjectItem(j_pst, "states"));
+  }
+  cJSON** states = calloc(nstate + 1, sizeof(cJSON*));
+  cJSON* j_states = cJSON_CreateArray();
+  int n = 0;
+  for(int j = 0; j < nphoneme; j ++) {
+    cJSON* j_pst = cJSON_GetObjectItem(j_phone_map, phonemes[j]);
+    cJSON* j_pst_states = cJSON_GetObjectItem(j_pst, "states");
+    int nst = cJSON_GetArraySize(j_pst_states);
+    cJSON* j_pskip = cJSON_GetObjectItem(j_pst, "pskip");
+    if(j_pskip != NULL && j_pskip -> valuedouble > 0 && n > 0)
+      add_jump(states[n - 1], nst + 1, j_pskip);
+    for(int k = 0; k < nst; k ++) {
+      cJSON* j_src = cJSON_GetArrayItem(j_pst_states, k);
+      cJSON* j_st = cJSON_CreateObject();
+      cJSON_AddNumberToObject(j_st, "time", n + 1);
+      cJSON_AddNumberToObject(j_st, "dur",
+        cJSON_GetObjectItem(j_src, "dur") -> valueint);
+      cJSON_AddItemToObject(j_st, "out",
+        cJSON_Duplicate(cJSON_GetObjectItem(j_src, "out"), 1));
+      cJSON_AddItemToObject(j_st, "jmp", cJSON_CreateArray());
+      cJSON* j_ext = cJSON_CreateArray();
+      cJSON_AddItemToArray(j_ext, cJSON_CreateString(phonemes[j]));
+      cJSON_AddItemToArray(j_ext, cJSON_CreateNumber(k));
+      cJSON_AddItemToObject(j_st, "ext", j_ext);
+      cJSON_AddItemToArray(j_states, j_st);
+      states[n ++] = j_st;
+    }
+
+    // M. T. Johnson, "Capacity and Complexity of HMM Duration Modeling Techniques".
+    //   IEEE Sigproc Letters, Vol. 12, No. 5, May 2005.
+    cJSON* j_topology = cJSON_GetObjectItem(j_pst, "topology");
+    const char* topology = j_topology == NULL || j_topology -> valuestring == NULL
+      ? "type-a" : j_topology -> valuestring;
+    if(! strcmp(topology, "type-b")) {
+      for(int k = 1; k <= nst - 2; k ++)
+        add_jump(states[n - nst + k - 1], nst - k, NULL);
+    } else if(! strcmp(topology, "type-c")) {
+      for(int k = 1; k <= nst - 2; k ++)
+        add_jump(states[n - nst + k - 1], 2, NULL);
+    } else if(! strcmp(topology, "skip-boundary")) {
+      if(n - nst - 1 >= 0) add_jump(states[n - nst - 1], 2, NULL);
+      if(n - 2 >= 0) add_jump(states[n - 2], 2, NULL);
+    }
+  }
+
+  double flatdur = (double)nfrm / nstate;
+  for(int k = 0; k < nstate; k ++) {
+    cJSON* j_st = states[k];
+    cJSON_ReplaceItemInObject(j_st, "time",
+      cJSON_CreateNumber(floor((k + 1) * flatdur + 0.5)));
+    cJSON* j_jmp = cJSON_GetObjectItem(j_st, "jmp");
+    int njmp = cJSON_GetArraySize(j_jmp);
+    if(njmp == 0) continue;
+    double jmpp = 0;
+    for(cJSON* j_d = j_jmp -> child; j_d != NULL; j_d = j_d -> next) {
+      cJSON* j_p = cJSON_GetObjectItem(j_d, "p");
+      if(j_p != NULL) jmpp += j_p -> valuedouble;
+    }
+    double avgp = 0.5 * (1 - jmpp) / njmp;
+    for(cJSON* j_d = j_jmp -> child; j_d != NULL; j_d = j_d -> next)
+      if(cJSON_GetObjectItem(j_d, "p") == NULL)
+        cJSON_AddNumberToObject(j_d, "p", avgp);
+  }
+  free(states);
+  return j_states;
+}
+
+extern char* optarg;
+int main(int argc, char** argv) {
+# ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+# endif
+  int c;
+  cJSON* j_pm = NULL;
+  const char* opt_directory = ".";
+  const char* opt_extension = ".f";
+  int opt_ndim = 36;
+  char** lpad = NULL; int nlpad = 0;
+  char** rpad = NULL; int nrpad = 0;
+
+  while((c = getopt(argc, argv, "m:d:e:n:L:R:h")) != -1) {
+    char* jsonstr = NULL;
+    switch(c) {
+    case 'm':
+      jsonstr = readall(optarg);
+      if(jsonstr == NULL) {
+        fprintf(stderr, "Error: cannot open %s.\n", optarg);
+        return 1;
+      }
+      j_pm = cJSON_Parse(jsonstr);
+      if(j_pm == NULL) {
+        fprintf(stderr, "Error: failed to parse %s.\n", optarg);
+        return 1;
+      }
+      free(jsonstr);
+    break;
+    case 'd':
+      opt_directory = optarg;
+    break;
+    case 'e':
+      opt_extension = optarg;
+    break;
+    case 'n':
+      opt_ndim = atoi(optarg);
+      if(opt_ndim < 1) {
+        fprintf(stderr, "Error: invalid frame size.\n");
+        return 1;
+      }
+    break;
+    case 'L':
+      lpad = delimit(optarg, ',', & nlpad);
+    break;
+    case 'R':
+      rpad = delimit(optarg, ',', & nrpad);
+    break;
+    case 'h':
+      print_usage();
+    break;
+    default:
+      abort();
+    }
+  }
+  if(j_pm == NULL) {
+    fprintf(stderr, "Error: shiro-mkseg requires an input phoneme map.\n");
+    return 1;
+  }
+  if(optind >= argc) {
+    fprintf(stderr, "Error: shiro-mkseg requires an input index file.\n");
+    return 1;
+  }
+  checkpm(j_pm);
+  cJSON* j_phone_map = cJSON_GetObjectItem(j_pm, "phone_map");
+
+  FILE* fin = fopen(argv[optind], "r");
+  if(fin == NULL) {
+    fprintf(stderr, "Error: cannot open %s\n", argv[optind]);
+    return 1;
+  }
+
+  // each entry is generated and written out before reading the next line
+  printf("{\n\t\"file_list\":\t[");
+  int nline = 0;
+  char* line = NULL;
+  while((line = read_line(fin)) != NULL) {
+    nline ++;
+    int len = strlen(line);
+    if(len > 0 && line[len - 1] == '\n') line[-- len] = 0;
+    if(len == 0) {
+      free(line);
+      break;
+    }
+    int nparts = 0;
+    char** parts = delimit(line, ',', & nparts);
+    if(nparts != 2) {
+      fprintf(stderr, "Error: format error at line %d.\n", nline);
+      return 1;
+    }
+    int nmiddle = 0;
+    char** middle = delimit(parts[1], ' ', & nmiddle);
+    int nphoneme = nlpad + nmiddle + nrpad;
+    char** phonemes = malloc((nphoneme + 1) * sizeof(char*));
+    for(int i = 0; i < nlpad; i ++) phonemes[i] = lpad[i];
+    for(int i = 0; i < nmiddle; i ++) phonemes[nlpad + i] = middle[i];
+    for(int i = 0; i < nrpad; i ++) phonemes[nlpad + nmiddle + i] = rpad[i];
+
+    char* feature_path = malloc(strlen(opt_directory) + strlen(parts[0]) +
+      strlen(opt_extension) + 2);
+    sprintf(feature_path, "%s/%s%s", opt_directory, parts[0], opt_extension);
+    long nfrm = get_feature_nframe(feature_path, opt_ndim);
+    if(nfrm == -1) {
+      fprintf(stderr, "Error: cannot open %s\n", feature_path);
+      return 1;
+    } else if(nfrm < 0) {
+      fprintf(stderr, "Error: size of %s does not match the frame size.\n",
+        feature_path);
+      return 1;
+    }
+
+    cJSON* j_entry = cJSON_CreateObject();
+    cJSON_AddStringToObject(j_entry, "filename", feature_path);
+    cJSON_AddItemToObject(j_entry, "states",
+      make_states(j_phone_map, phonemes, nphoneme, nfrm));
+    char* jsonstr = cJSON_Print(j_entry);
+    printf("%s%s", nline > 1 ? ", " : "", jsonstr);
+    free(jsonstr);
+    cJSON_Delete(j_entry);
+
+    free(feature_path);
+    free(phonemes);
+    free_tokens(middle, nmiddle);
+    free_tokens(parts, nparts);
+    free(line);
+  }
+  printf("]\n}\n");
+  fclose(fin);
+
+  if(lpad != NULL) free_tokens(lpad, nlpad);
+  if(rpad != NULL) free_tokens(rpad, nrpad);
+  cJSON_Delete(j_pm);
+  return 0;
+}
@@ -88,9 +88,8 @@ for i = 1, #file_list do
     print("Error: cannot open " .. feature_path)
     return
   end
-  local feature_size = fh:seek("end") / 4
-  local nfrm = feature_size / ndim
-  if nfrm ~= math.floor(nfrm) then
+  local nfrm = shiro_cli.feature_nframe(fh, tonumber(ndim))
+  if nfrm == nil then
     print("Error: size of " .. feature_path .. " does not match the frame size.")
     return
   end
@@ -48,10 +48,15 @@ static void print_usage() {
     "  -d extra-duration-search-space\n"
     "  -t termination-threshold\n"
     "  -l export-likelihood-file\n"
+    "  -R export-pruning-statistics-file\n"
     "  -i (isolated training)\n"
+    "  -b mini-batch-size (in files)\n"
+    "  -B num-mini-batch-epoch (before full-batch iterations)\n"
+    "  -k step-size-decay (mini-batch, 0.5 - 1, default 0.7)\n"
     "  -D (DAEM training)\n"
     "  -T (enable multi-threading)\n"
     "  -M (display-mean-frame-likelihood)\n"
+    "  -N normalization-statistics-file (from shiro-cmvn)\n"
     "  -h (print usage)\n");
   exit(1);
 }
@@ -62,14 +67,20 @@ int opt_daem = 0;
 int opt_mthread = 0;
 int opt_meanlikelihood = 0;
 int opt_embdtrain = 1;
+int opt_batchsize = 0;
+int opt_nepoch = 0;
+FP_TYPE opt_decay = 0.7;
 FILE* fp_likelihood = NULL;
+FILE* fp_prune = NULL;
 
 FP_TYPE reestimate(lrh_model_stat* hstat, lrh_model* hsmm, lrh_observ* o,
-  cJSON* j_states) {
+  cJSON* j_states, int f) {
   FP_TYPE lh = 0;
   if(! opt_embdtrain) {
+    prof_stamp p = prof_start();
     lrh_dataset* d = load_isolated_data_from_json(j_states, o);
     int nsample = d -> observset -> nsample;
+    prof_stop(p, "load_seg", f, 0, nsample);
     for(int e = 0; e < nsample; e ++) {
       lrh_seg* es = d -> segset -> samples[e];
       lrh_observ* eo = d -> observset -> samples[e];
@@ -78,10 +89,12 @@ FP_TYPE reestimate(lrh_model_stat* hstat, lrh_model* hsmm, lrh_observ* o,
           es -> time[i] = eo -> nt;
       lrh_seg_buildjumps(es);
       FP_TYPE e_lh = 0;
+      p = prof_start();
       if(opt_geodur)
         e_lh = lrh_estimate_geometric(hstat, hsmm, eo, es);
       else
         e_lh = lrh_estimate(hstat, hsmm, eo, es);
+      prof_stop(p, "estimate", f, eo -> nt, es -> nseg);
       if(opt_meanlikelihood)
         e_lh /= eo -> nt;
       if(fp_likelihood != NULL)
@@ -90,15 +103,19 @@ FP_TYPE reestimate(lrh_model_stat* hstat, lrh_model* hsmm, lrh_observ* o,
     }
     delete_dataset(d);
   } else {
+    prof_stamp p = prof_start();
     lrh_seg* s = load_seg_from_json(j_states, hsmm -> nstream);
     for(int i = 0; i < s -> nseg; i ++)
       if(s -> time[i] > o -> nt)
         s -> time[i] = o -> nt;
     lrh_seg_buildjumps(s);
+    prof_stop(p, "load_seg", f, 0, s -> nseg);
+    p = prof_start();
     if(opt_geodur)
       lh = lrh_estimate_geometric(hstat, hsmm, o, s);
     else
       lh = lrh_estimate(hstat, hsmm, o, s);
+    prof_stop(p, "estimate", f, o -> nt, s -> nseg);
     if(opt_meanlikelihood)
       lh /= o -> nt;
     if(fp_likelihood != NULL)
@@ -108,6 +125,232 @@ FP_TYPE reestimate(lrh_model_stat* hstat, lrh_model* hsmm, lrh_observ* o,
   return lh;
 }
 
+/*
+  Scheduling. Files are dispatched longest-first (by the number of frames,
+    from the feature file size, times the number of states) to threads that
+    pick up the next file as soon as they are idle, so that a few long
+    utterances at the end of the list do not leave all but one thread waiting.
+*/
+
+long* file_cost = NULL;
+
+static void estimate_file_cost(lrh_model* hsmm, cJSON* j_file_list) {
+  int nfile = cJSON_GetArraySize(j_file_list);
+  int stride = 0;
+  for(int l = 0; l < hsmm -> nstream; l ++)
+    stride += hsmm -> streams[l] -> gmms[0] -> ndim;
+  file_cost = malloc(nfile * sizeof(long));
+  for(int f = 0; f < nfile; f ++) {
+    cJSON* j_file_list_f = cJSON_GetArrayItem(j_file_list, f);
+    cJSON* j_filename = cJSON_GetObjectItem(j_file_list_f, "filename");
+    checkvar(filename);
+    cJSON* j_states = cJSON_GetObjectItem(j_file_list_f, "states");
+    checkvar(states);
+    long nt = get_feature_nframe(j_filename -> valuestring, stride);
+    file_cost[f] = max(nt, 1) * max(cJSON_GetArraySize(j_states), 1);
+  }
+}
+
+static int compare_cost(const void* a, const void* b) {
+  int fa = *(const int*)a;
+  int fb = *(const int*)b;
+  if(file_cost[fa] != file_cost[fb])
+    return file_cost[fa] < file_cost[fb] ? 1 : -1;
+  return fa - fb;
+}
+
+static void print_thread_load(double* busy, int nthread) {
+  if(nthread < 2) return;
+  double sum = 0, lo = busy[0], hi = busy[0];
+  for(int i = 0; i < nthread; i ++) {
+    sum += busy[i];
+    lo = min(lo, busy[i]);
+    hi = max(hi, busy[i]);
+  }
+  fprintf(stderr, "Thread busy time: min = %.2fs, max = %.2fs, "
+    "mean = %.2fs (imbalance = %.1f%%).\n", lo, hi, sum / nthread,
+    sum > 0 ? (hi / (sum / nthread) - 1.0) * 100.0 : 0);
+}
+
+// accumulate the statistics of the files fidx[0 .. n - 1] (or the first n
+//   files if fidx is NULL) into hstat and return the total log likelihood
+static FP_TYPE expectation(lrh_model_stat* hstat, lrh_model* hsmm,
+  cJSON* j_file_list, int* fidx, int n, int iter) {
+  FP_TYPE total_lh = 0;
+  long total_nt = 0;
+  prune_summary prune_total = {0};
+  int* order = malloc(n * sizeof(int));
+  for(int k = 0; k < n; k ++)
+    order[k] = fidx == NULL ? k : fidx[k];
+  // the likelihood file is written in file order
+  if(fp_likelihood == NULL) {
+    if(file_cost == NULL)
+      estimate_file_cost(hsmm, j_file_list);
+    qsort(order, n, sizeof(int), compare_cost);
+  }
+  int nthread = omp_get_max_threads();
+  double* busy = calloc(nthread, sizeof(double));
+
+  prof_stamp p = prof_start();
+# pragma omp parallel for schedule(dynamic) reduction(+:total_lh)
+  for(int k = 0; k < n; k ++) {
+    int f = order[k];
+    double t0 = omp_get_wtime();
+    cJSON* j_file_list_f = cJSON_GetArrayItem(j_file_list, f);
+    cJSON* j_filename = cJSON_GetObjectItem(j_file_list_f, "filename");
+    checkvar(filename);
+    cJSON* j_states = cJSON_GetObjectItem(j_file_list_f, "states");
+    checkvar(states);
+    
+    prof_stamp pf = prof_start();
+    lrh_observ* o = load_observ_from_float(j_filename -> valuestring, hsmm);
+    if(o == NULL) exit(1);
+    prof_stop(pf, "load_observ", f, o -> nt, 0);
+#   pragma omp atomic
+    total_nt += o -> nt;
+    FP_TYPE e = reestimate(hstat, hsmm, o, j_states, f);
+    if(fp_prune != NULL && fidx == NULL) {
+      // an extra Viterbi pass under the same pruning settings
+      lrh_seg* s = load_seg_from_json(j_states, hsmm -> nstream);
+      int* endtime = malloc(s -> nseg * sizeof(int));
+      int ok = viterbi_endtime(hsmm, o, s, 0, endtime);
+      prune_stat st = get_prune_stat(s, endtime, o -> nt, ! ok);
+      free(endtime);
+      lrh_delete_seg(s);
+#     pragma omp critical(prune_stat)
+      {
+        char prefix[32];
+        sprintf(prefix, "%d,", iter);
+        print_prune_stat(fp_prune, prefix, j_filename -> valuestring, st);
+        add_prune_stat(& prune_total, st);
+      }
+    }
+    if(e < -1e8) {
+      fprintf(stderr, "Inference failed on file %d (%s).\n", f,
+        j_filename -> valuestring);
+    }
+    total_lh += e;
+    lrh_delete_observ(o);
+    busy[omp_get_thread_num()] += omp_get_wtime() - t0;
+  }
+  prof_stop(p, "expectation", -1, total_nt, 0);
+  if(fidx == NULL)
+    print_thread_load(busy, nthread);
+  free(busy);
+  free(order);
+  if(fp_prune != NULL && fidx == NULL)
+    print_prune_summary(& prune_total);
+  return total_lh;
+}
+
+/*
+  Mini-batch EM (stepwise EM). Running sufficient statistics are kept across
+    batches: the statistics of each batch, scaled to the size of the corpus,
+    are blended in as s = (1 - eta) s + eta s_batch with a step size of
+    eta = (k + 2)^-decay, k being the number of batches processed so far, and
+    the model is re-estimated from the blended statistics. Each state thus
+    moves in proportion to its occupancy in the batch, and states absent from
+    the batch keep their parameters. The running statistics start from those
+    of the initial model at an occupancy of MINIBATCH_PRIOR frames per state.
+*/
+
+#define MINIBATCH_PRIOR 1.0
+
+// statistics of h itself, as if collected from count frames per state
+static void model_prior_stat(lrh_model_stat* dst, lrh_model* h,
+  FP_TYPE count) {
+  for(int l = 0; l < h -> nstream; l ++)
+    for(int i = 0; i < h -> streams[l] -> ngmm; i ++) {
+      lrh_gmm* g = h -> streams[l] -> gmms[i];
+      lrh_gmm_stat* gs = dst -> streams[l] -> gmms[i];
+      for(int k = 0; k < g -> nmix; k ++) {
+        FP_TYPE w = g -> weight[k] * count;
+        gs -> weightsum[k] = w;
+        for(int j = 0; j < g -> ndim; j ++) {
+          FP_TYPE mu = lrh_gmmu(g, k, j);
+          gs -> mu[k * g -> ndim + j] = w * mu;
+          gs -> var[k * g -> ndim + j] = w * (lrh_gmmv(g, k, j) + mu * mu);
+        }
+      }
+    }
+  for(int i = 0; i < h -> nduration; i ++) {
+    FP_TYPE mu = h -> durations[i] -> mean;
+    dst -> durations[i] -> weightsum = count;
+    dst -> durations[i] -> mean = count * mu;
+    dst -> durations[i] -> var = count * (h -> durations[i] -> var + mu * mu);
+  }
+}
+
+static void blend_array(FP_TYPE* dst, FP_TYPE* src, int n, FP_TYPE eta,
+  FP_TYPE scale) {
+  for(int k = 0; k < n; k ++)
+    dst[k] = dst[k] * (1.0 - eta) + src[k] * scale * eta;
+}
+
+// dst <- (1 - eta) dst + eta scale src
+static void blend_model_stat(lrh_model_stat* dst, lrh_model_stat* src,
+  FP_TYPE eta, FP_TYPE scale) {
+  for(int l = 0; l < dst -> nstream; l ++)
+    for(int i = 0; i < dst -> streams[l] -> ngmm; i ++) {
+      lrh_gmm_stat* d = dst -> streams[l] -> gmms[i];
+      lrh_gmm_stat* s = src -> streams[l] -> gmms[i];
+      blend_array(d -> weightsum, s -> weightsum, d -> nmix, eta, scale);
+      blend_array(d -> mu, s -> mu, d -> nmix * d -> ndim, eta, scale);
+      blend_array(d -> var, s -> var, d -> nmix * d -> ndim, eta, scale);
+    }
+  for(int i = 0; i < dst -> nduration; i ++) {
+    lrh_duration_stat* d = dst -> durations[i];
+    lrh_duration_stat* s = src -> durations[i];
+    blend_array(& d -> weightsum, & s -> weightsum, 1, eta, scale);
+    blend_array(& d -> mean, & s -> mean, 1, eta, scale);
+    blend_array(& d -> var, & s -> var, 1, eta, scale);
+  }
+}
+
+// returns the number of mini-batch steps taken; the full-batch iterations
+//   are numbered after them in the profile and the pruning statistics
+static int train_minibatch(lrh_model* hsmm, cJSON* j_file_list) {
+  int nfile = cJSON_GetArraySize(j_file_list);
+  // the likelihood file (-l) has one line per file per full-batch iteration
+  FILE* saved_likelihood = fp_likelihood;
+  fp_likelihood = NULL;
+  int* order = malloc(nfile * sizeof(int));
+  for(int f = 0; f < nfile; f ++) order[f] = f;
+  srand(1);
+  lrh_model_stat* running = model_stat_from_model(hsmm);
+  model_prior_stat(running, hsmm, MINIBATCH_PRIOR);
+  int nstep = 0;
+  for(int epoch = 0; epoch < opt_nepoch; epoch ++) {
+    for(int f = nfile - 1; f > 0; f --) { // reshuffle every epoch
+      int r = rand() % (f + 1);
+      int tmp = order[f]; order[f] = order[r]; order[r] = tmp;
+    }
+    FP_TYPE total_lh = 0;
+    for(int b = 0; b < nfile; b += opt_batchsize) {
+      int n = min(opt_batchsize, nfile - b);
+      FP_TYPE eta = pow(nstep + 2, -opt_decay);
+      prof_iteration = nstep;
+
+      lrh_model_stat* hstat = model_stat_from_model(hsmm);
+      model_precompute(hsmm);
+      total_lh += expectation(hstat, hsmm, j_file_list, order + b, n, nstep);
+      prof_stamp p = prof_start();
+      blend_model_stat(running, hstat, eta, (FP_TYPE)nfile / n);
+      model_update(hsmm, running, opt_geodur);
+      prof_stop(p, "update", -1, 0, 0);
+      lrh_delete_model_stat(hstat);
+      nstep ++;
+    }
+    fprintf(stderr, "Mini-batch epoch %d/%d (%d steps), average log "
+      "likelihood = %f.\n", epoch, opt_nepoch, nstep,
+      total_lh / nfile / lrh_daem_temperature);
+  }
+  lrh_delete_model_stat(running);
+  free(order);
+  fp_likelihood = saved_likelihood;
+  return nstep;
+}
+
 extern char* optarg;
 int main(int argc, char** argv) {
 # ifdef _WIN32
@@ -116,13 +359,16 @@ int main(int argc, char** argv) {
   int c;
   cJSON* j_segm = NULL;
   lrh_model* hsmm = NULL;
+  prof_init("shiro-rest");
 
   FP_TYPE opt_threshold = 1.0;
-  while((c = getopt(argc, argv, "m:s:n:gp:P:d:t:l:iDTMh")) != -1) {
+  while((c = getopt(argc, argv, "m:s:n:gp:P:d:t:l:R:b:B:k:N:iDTMh")) != -1) {
     char* jsonstr = NULL;
+    prof_stamp p = prof_start();
     switch(c) {
     case 'm':
       hsmm = load_model(optarg);
+      prof_stop(p, "load_model", -1, 0, 0);
       if(hsmm == NULL) {
         fprintf(stderr, "Error: failed to load model from %s\n", optarg);
         return 1;
@@ -140,6 +386,7 @@ int main(int argc, char** argv) {
         return 1;
       }
       free(jsonstr);
+      prof_stop(p, "parse_json", -1, 0, 0);
     break;
     case 'n':
       opt_niter = atoi(optarg);
@@ -169,6 +416,27 @@ int main(int argc, char** argv) {
         exit(1);
       }
     break;
+    case 'R':
+      fp_prune = fopen(optarg, "w");
+      if(fp_prune == NULL) {
+        fprintf(stderr, "Error: cannot create %s\n", optarg);
+        exit(1);
+      }
+      print_prune_header(fp_prune, "iteration,");
+    break;
+    case 'b':
+      opt_batchsize = atoi(optarg);
+    break;
+    case 'B':
+      opt_nepoch = atoi(optarg);
+    break;
+    case 'k':
+      opt_decay = atof(optarg);
+      if(opt_decay <= 0.5 || opt_decay > 1) {
+        fprintf(stderr, "Warning: step-size decay outside (0.5, 1] may "
+          "not converge.\n");
+      }
+    break;
     case 'D':
       opt_daem = 1;
     break;
@@ -178,6 +446,14 @@ int main(int argc, char** argv) {
     case 'M':
       opt_meanlikelihood = 1;
     break;
+    case 'N':
+      feature_cmvn = load_cmvn(optarg);
+      if(feature_cmvn == NULL) {
+        fprintf(stderr, "Error: failed to load normalization statistics from "
+          "%s.\n", optarg);
+        return 1;
+      }
+    break;
     case 'h':
       print_usage();
     break;
@@ -206,10 +482,27 @@ int main(int argc, char** argv) {
     fprintf(stderr, "Warning: OpenMP is not supported by this build.\n");
 # endif
 
+  if(fp_prune != NULL && (opt_geodur || ! opt_embdtrain)) {
+    fprintf(stderr, "Warning: pruning statistics are not available for "
+      "isolated or geometric-duration training.\n");
+    fclose(fp_prune);
+    fp_prune = NULL;
+  }
+
   cJSON* j_file_list = cJSON_GetObjectItem(j_segm, "file_list");
   checkvar(file_list);
   int nfile = cJSON_GetArraySize(j_file_list);
 
+  int nminibatch = 0;
+  if(opt_nepoch > 0 && opt_batchsize > 0) {
+    if(opt_daem)
+      fprintf(stderr, "Warning: DAEM is only applied to full-batch "
+        "iterations.\n");
+    nminibatch = train_minibatch(hsmm, j_file_list);
+  } else if(opt_nepoch > 0 || opt_batchsize > 0) {
+    fprintf(stderr, "Warning: mini-batch EM requires both -b and -B.\n");
+  }
+
   FP_TYPE prev_lh = 0;
   for(int iter = 0; iter < opt_niter; iter ++) {
     if(opt_daem) {
@@ -220,33 +513,23 @@ int main(int argc, char** argv) {
       fprintf(stderr, "Running iteration %d/%d...\n", iter, opt_niter);
     }
 
-    FP_TYPE total_lh = 0;
-
-    lrh_model_stat* hstat = lrh_model_stat_from_model(hsmm);
-    lrh_model_precompute(hsmm);
-#   pragma omp parallel for
-    for(int f = 0; f < nfile; f ++) {
-      cJSON* j_file_list_f = cJSON_GetArrayItem(j_file_list, f);
-      cJSON* j_filename = cJSON_GetObjectItem(j_file_list_f, "filename");
-      checkvar(filename);
-      cJSON* j_states = cJSON_GetObjectItem(j_file_list_f, "states");
-      checkvar(states);
-      
-      lrh_observ* o = load_observ_from_float(j_filename -> valuestring, hsmm);
-      FP_TYPE e = reestimate(hstat, hsmm, o, j_states);
-      if(e < -1e8) {
-        fprintf(stderr, "Inference failed on file %d (%s).\n", f,
-          j_filename -> valuestring);
-      }
-      total_lh += e;
-      lrh_delete_observ(o);
-    }
+    prof_iteration = nminibatch + iter;
+    prof_stamp p = prof_start();
+    lrh_model_stat* hstat = model_stat_from_model(hsmm);
+    prof_stop(p, "create_stat", -1, 0, 0);
+    p = prof_start();
+    model_precompute(hsmm);
+    prof_stop(p, "precompute", -1, 0, 0);
+    FP_TYPE total_lh = expectation(hstat, hsmm, j_file_list, NULL, nfile,
+      nminibatch + iter);
 
+    p = prof_start();
     if(opt_geodur)
-      lrh_model_update(hsmm, hstat, 1);
+      model_update(hsmm, hstat, 1);
     else
-      lrh_model_update(hsmm, hstat, 0);
+      model_update(hsmm, hstat, 0);
     lrh_delete_model_stat(hstat);
+    prof_stop(p, "update", -1, 0, 0);
 
     FP_TYPE mean_lh = total_lh / nfile / lrh_daem_temperature;
     fprintf(stderr, "Average log likelihood = %f.\n", mean_lh);
@@ -257,13 +540,17 @@ int main(int argc, char** argv) {
     prev_lh = mean_lh;
   }
 
-  cmp_ctx_t cmpobj;
-  cmp_init(& cmpobj, stdout, file_reader, file_writer);
-  lrh_write_model(& cmpobj, hsmm);
+  prof_iteration = -1;
+  prof_stamp p = prof_start();
+  write_model(stdout, hsmm);
+  prof_stop(p, "write_model", -1, 0, 0);
 
   cJSON_Delete(j_segm);
-  lrh_delete_model(hsmm);
+  delete_cmvn(feature_cmvn);
+  delete_model(hsmm);
   if(fp_likelihood != NULL) fclose(fp_likelihood);
+  if(fp_prune != NULL) fclose(fp_prune);
+  free(file_cost);
   return 0;
 }
 
@@ -0,0 +1,209 @@
+/*
+  SHIRO
+  ===
+  Copyright (c) 2018 Kanru Hua. All rights reserved.
+
+  This file is part of SHIRO.
+
+  SHIRO is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  SHIRO is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with SHIRO.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "external/cJSON/cJSON.h"
+#include "external/liblrhsmm/common.h"
+#include "external/liblrhsmm/serial.h"
+#include <omp.h>
+
+#include "cli-common.h"
+
+static void print_usage() {
+  fprintf(stderr,
+    "shiro-seg2lab path-to-segmentation-file\n"
+    "  -t hop-time (in seconds, default 0.01)\n"
+    "  -e extension (default .txt)\n"
+    "  -s (output state-level alignment)\n"
+    "  -T (enable multi-threading)\n"
+    "  -h (print usage)\n");
+  exit(1);
+}
+
+// entries read ahead and written in parallel
+#define SEG2LAB_BATCH 256
+
+// same path without the extension; behaves like string.rmext in misc.lua
+static char* rmext(const char* path) {
+  int n = strlen(path);
+  char* ret = malloc(n + 1);
+  strcpy(ret, path);
+  for(int i = n - 1; i >= 0; i --)
+    if(ret[i] == '.') {
+      ret[i] = 0;
+      break;
+    } else if(ret[i] == '/' || ret[i] == '\\')
+      break;
+  return ret;
+}
+
+static void write_label(FILE* fout, double t0, double t1, cJSON* j_label) {
+  if(j_label != NULL && j_label -> valuestring != NULL)
+    fprintf(fout, "%.14g\t%.14g\t%s\r\n", t0, t1, j_label -> valuestring);
+  else
+    fprintf(fout, "%.14g\t%.14g\t%.14g\r\n", t0, t1,
+      j_label == NULL ? 0 : j_label -> valuedouble);
+}
+
+// returns 0 on success
+static int seg2lab(cJSON* j_entry, const char* ext, double hop_time,
+  int state_align) {
+  cJSON* j_filename = cJSON_GetObjectItem(j_entry, "filename");
+  cJSON* j_states = cJSON_GetObjectItem(j_entry, "states");
+  if(j_filename == NULL || j_states == NULL) {
+    fprintf(stderr, "Error: missing JSON attribute: \"filename\" or "
+      "\"states\"\n");
+    return 1;
+  }
+  if(j_states -> child == NULL) return 0;
+
+  char* base = rmext(j_filename -> valuestring);
+  char* path = malloc(strlen(base) + strlen(ext) + 1);
+  sprintf(path, "%s%s", base, ext);
+  free(base);
+  FILE* fout = fopen(path, "w");
+  if(fout == NULL) {
+    fprintf(stderr, "Error: cannot write to %s\n", path);
+    free(path);
+    return 1;
+  }
+
+  double t0 = 0, t1 = 0, t0s = 0;
+  double curr_idx = 100;
+  cJSON* j_curr_phone = NULL;
+  for(cJSON* j_st = j_states -> child; j_st != NULL; j_st = j_st -> next) {
+    cJSON* j_time = cJSON_GetObjectItem(j_st, "time");
+    cJSON* j_ext = cJSON_GetObjectItem(j_st, "ext");
+    if(j_time == NULL || j_ext == NULL) {
+      fprintf(stderr, "Error: missing JSON attribute: \"time\" or \"ext\"\n");
+      fclose(fout);
+      free(path);
+      return 1;
+    }
+    cJSON* j_phone = cJSON_GetArrayItem(j_ext, 0);
+    cJSON* j_idx = cJSON_GetArrayItem(j_ext, 1);
+    if(j_phone == NULL || j_phone -> valuestring == NULL) {
+      fprintf(stderr, "Error: invalid \"ext\" attribute in %s\n",
+        j_filename -> valuestring);
+      fclose(fout);
+      free(path);
+      return 1;
+    }
+    double idx = j_idx == NULL ? 0 : j_idx -> valuedouble;
+    if(j_curr_phone != NULL && (idx <= curr_idx ||
+       strcmp(j_phone -> valuestring, j_curr_phone -> valuestring))) {
+      write_label(fout, t0, t1, j_curr_phone);
+      t0 = t1;
+    }
+    j_curr_phone = j_phone;
+    curr_idx = idx;
+    t1 = j_time -> valuedouble * hop_time;
+    if(state_align)
+      write_label(fout, t0s, t1, j_idx);
+    t0s = t1;
+  }
+  write_label(fout, t0, t1, j_curr_phone);
+
+  fclose(fout);
+  free(path);
+  return 0;
+}
+
+extern char* optarg;
+int main(int argc, char** argv) {
+  int c;
+  double opt_hoptime = 0.01;
+  const char* opt_extension = ".txt";
+  int opt_statealign = 0;
+  int opt_mthread = 0;
+
+  while((c = getopt(argc, argv, "t:e:sTh")) != -1) {
+    switch(c) {
+    case 't':
+      opt_hoptime = atof(optarg);
+      if(opt_hoptime <= 0) {
+        fprintf(stderr, "Error: invalid hop time.\n");
+        return 1;
+      }
+    break;
+    case 'e':
+      opt_extension = optarg;
+    break;
+    case 's':
+      opt_statealign = 1;
+    break;
+    case 'T':
+      opt_mthread = 1;
+    break;
+    case 'h':
+      print_usage();
+    break;
+    default:
+      abort();
+    }
+  }
+  if(optind >= argc) {
+    fprintf(stderr, "Error: shiro-seg2lab requires an input segmentation "
+      "file.\n");
+    return 1;
+  }
+# ifdef _OPENMP
+  if(opt_mthread == 0)
+    omp_set_num_threads(1);
+# endif
+
+  file_list_reader* reader = open_file_list(argv[optind]);
+  if(reader == NULL) {
+    fprintf(stderr, "Error: cannot open %s.\n", argv[optind]);
+    return 1;
+  }
+
+  // Entries are read in batches so that memory stays bounded; the label files
+  //   of a batch are written in parallel.
+  cJSON* batch[SEG2LAB_BATCH];
+  int nfile = 0, nfailed = 0;
+  while(1) {
+    int n = 0;
+    while(n < SEG2LAB_BATCH && (batch[n] = next_file_list_entry(reader)))
+      n ++;
+    if(n == 0) break;
+#   pragma omp parallel for schedule(dynamic) reduction(+:nfailed)
+    for(int i = 0; i < n; i ++)
+      nfailed += seg2lab(batch[i], opt_extension, opt_hoptime,
+        opt_statealign);
+    for(int i = 0; i < n; i ++)
+      cJSON_Delete(batch[i]);
+    nfile += n;
+    if(n < SEG2LAB_BATCH) break;
+  }
+  int error = reader -> error;
+  close_file_list(reader);
+
+  if(error) {
+    fprintf(stderr, "Error: failed to parse %s.\n", argv[optind]);
+    return 1;
+  }
+  fprintf(stderr, "Converted %d file(s).\n", nfile - nfailed);
+  return nfailed > 0;
+}
@@ -182,9 +182,7 @@ int main(int argc, char** argv) {
     }
   }
   
-  cmp_ctx_t cmpobj;
-  cmp_init(& cmpobj, stdout, file_reader, file_writer);
-  lrh_write_model(& cmpobj, cdhsmm);
+  write_model(stdout, cdhsmm);
   
   if(fp_out_segm != NULL) {
     char* jsonstr = cJSON_Print(j_segm);
@@ -196,7 +194,7 @@ int main(int argc, char** argv) {
     fclose(fp_out_summary);
   
   cJSON_Delete(j_segm);
-  lrh_delete_model(hsmm);
+  delete_model(hsmm);
   lrh_delete_model(cdhsmm);
   return 0;
 }
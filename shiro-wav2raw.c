@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <fcntl.h>
@@ -31,6 +32,7 @@
 #endif
 
 #include "external/ciglet/ciglet.h"
+#include "resample.h"
 
 char* mystrdup(const char *str) {
   int n = strlen(str) + 1;
@@ -69,13 +71,92 @@ static void write_float_data(const char* path, FP_TYPE* x, int nx) {
   fclose(fout);
 }
 
+#define RESAMPLE_CIGLET 0
+#define RESAMPLE_POLYPHASE 1
+#define RESAMPLE_POLYPHASE_FAST 2
+
+static const char* resample_methods[] = {
+  "ciglet", "polyphase", "polyphase-fast"};
+
+static FP_TYPE* resample_by(int method, FP_TYPE* x, int nx, int fs_in,
+  int fs_out, int* ny) {
+  if(method != RESAMPLE_CIGLET) {
+    resampler* rs = method == RESAMPLE_POLYPHASE ?
+      create_resampler(fs_in, fs_out, 16, 0.94, 8.0) :
+      create_resampler(fs_in, fs_out, 8, 0.95, 6.0);
+    if(rs != NULL) {
+      FP_TYPE* y = resample(rs, x, nx, ny);
+      delete_resampler(rs);
+      return y;
+    }
+    fprintf(stderr, "Warning: the ratio between %d Hz and %d Hz is too "
+      "fine for the polyphase resampler; using ciglet instead.\n",
+      fs_in, fs_out);
+  }
+  return rresample(x, nx, (FP_TYPE)fs_out / fs_in, ny);
+}
+
+/*
+  Quality/speed comparison on a synthetic 30 second signal. The passband SNR
+    is measured on tones up to 0.8 x the output Nyquist frequency against
+    their exact values at the output rate; the stopband attenuation is the
+    level of a tone at 1.5 x the output Nyquist frequency after resampling.
+*/
+static void run_benchmark(int fs_in, int fs_out) {
+  const double pi = 3.14159265358979;
+  double ftone[] = {200, 1000, 3000, fs_out * 0.5 * 0.8};
+  double fstop = fs_out * 0.75;
+  int nx = fs_in * 30;
+  FP_TYPE* xpass = calloc(nx, sizeof(FP_TYPE));
+  FP_TYPE* xstop = calloc(nx, sizeof(FP_TYPE));
+  for(int i = 0; i < nx; i ++) {
+    for(int j = 0; j < 4; j ++)
+      xpass[i] += 0.2 * sin(2 * pi * ftone[j] * i / fs_in);
+    xstop[i] = 0.5 * sin(2 * pi * fstop * i / fs_in);
+  }
+  printf("%d Hz -> %d Hz, %.0f s of audio\n", fs_in, fs_out,
+    (double)nx / fs_in);
+  printf("%-16s %10s %12s %12s %14s\n", "method", "seconds", "x realtime",
+    "SNR (dB)", "stopband (dB)");
+  for(int m = 0; m < 3; m ++) {
+    int ny = 0;
+    clock_t t0 = clock();
+    FP_TYPE* y = resample_by(m, xpass, nx, fs_in, fs_out, & ny);
+    double elapsed = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    double err = 0, sig = 0;
+    int margin = fs_out / 10;
+    for(int n = margin; n < ny - margin; n ++) {
+      double ref = 0;
+      for(int j = 0; j < 4; j ++)
+        ref += 0.2 * sin(2 * pi * ftone[j] * n / fs_out);
+      err += (y[n] - ref) * (y[n] - ref);
+      sig += ref * ref;
+    }
+    free(y);
+    y = resample_by(m, xstop, nx, fs_in, fs_out, & ny);
+    double leak = 0;
+    for(int n = margin; n < ny - margin; n ++)
+      leak += y[n] * y[n];
+    free(y);
+    double stop = 0.125 * (ny - 2 * margin); // power of the input tone
+    printf("%-16s %10.3f %12.1f %12.1f %14.1f\n", resample_methods[m],
+      elapsed, (double)nx / fs_in / max(elapsed, 1e-6),
+      10 * log10(sig / max(err, 1e-30)), 10 * log10(max(leak, 1e-30) / stop));
+  }
+  free(xpass);
+  free(xstop);
+}
+
 static void print_usage() {
   fprintf(stderr,
     "shiro-wav2raw path-to-wav-file\n"
     "  -e extension of the output\n"
     "  -r sample rate of the output\n"
+    "  -R resampling-method (ciglet/polyphase/polyphase-fast, "
+      "default: ciglet)\n"
     "  -d dithering noise level\n"
     "  -N (normalize)\n"
+    "  -B input-sample-rate (benchmark the resampling methods and exit)\n"
     "  -h (print usage)\n");
   exit(1);
 }
@@ -91,8 +172,10 @@ int main(int argc, char** argv) {
   int opt_normalize = 0;
   char* opt_extension = mystrdup(".raw");
   int opt_fs = 0;
+  int opt_method = RESAMPLE_CIGLET;
+  int opt_benchmark = 0;
   float dithering = 0;
-  while((c = getopt(argc, argv, "e:r:d:Nh")) != -1) {
+  while((c = getopt(argc, argv, "e:r:R:d:NB:h")) != -1) {
     switch(c) {
     case 'e':
       free(opt_extension);
@@ -105,6 +188,23 @@ int main(int argc, char** argv) {
         exit(1);
       }
     break;
+    case 'R':
+      opt_method = -1;
+      for(int i = 0; i < 3; i ++)
+        if(! strcmp(optarg, resample_methods[i]))
+          opt_method = i;
+      if(opt_method < 0) {
+        fprintf(stderr, "Error: unknown resampling method %s.\n", optarg);
+        exit(1);
+      }
+    break;
+    case 'B':
+      opt_benchmark = atoi(optarg);
+      if(opt_benchmark <= 0) {
+        fprintf(stderr, "Error: invalid sample rate.\n");
+        exit(1);
+      }
+    break;
     case 'd':
       dithering = atof(optarg);
     break;
@@ -119,6 +219,12 @@ int main(int argc, char** argv) {
     }
   }
 
+  if(opt_benchmark > 0) {
+    run_benchmark(opt_benchmark, opt_fs > 0 ? opt_fs : 16000);
+    free(opt_extension);
+    return 0;
+  }
+
   if(optind >= argc) {
     fprintf(stderr, "Error: missing argument path-to-wav-file.\n");
     exit(1);
@@ -149,9 +255,8 @@ int main(int argc, char** argv) {
   }
   
   if(opt_fs > 0 && opt_fs != fs) { // needs resampling
-    FP_TYPE ratio = (FP_TYPE)opt_fs / fs;
     int ny = 0;
-    FP_TYPE* y = rresample(x, nx, ratio, & ny);
+    FP_TYPE* y = resample_by(opt_method, x, nx, fs, opt_fs, & ny);
     write_float_data(output_raw, y, ny);
     free(y);
   } else {
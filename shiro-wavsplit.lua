@@ -31,7 +31,7 @@ json = require("dkjson")
 getopt = require("getopt")
 shiro_cli = require("cli-common")
 
-opts = getopt(arg, "ntdfNsvli")
+opts = getopt(arg, "ntdfNsvlia")
 
 if opts.h then
   print("Usage:")
@@ -45,6 +45,7 @@ if opts.h then
   print("  -v min-voicing-duration")
   print("  -l load-existing-model")
   print("  -i load-initial-model")
+  print("  -a long-form-anchor-interval (in seconds)")
   return
 end
 
@@ -150,10 +151,14 @@ if opts.l == nil then
     " -D -t 0 > " .. path_hsmm_trained)
 end
 
--- Align
+-- Align; long recordings can optionally be aligned in anchored chunks
+local long_form = ""
+if opts.a ~= nil then
+  long_form = " -L " .. math.floor(tonumber(opts.a) / thop) .. " -T"
+end
 os.execute(mypath .. "shiro-align -m " .. path_hsmm_trained ..
   " -s " .. path_seg_init .. " -d " .. extradur ..
-  " -p " .. stprune .. " > " .. path_seg_aligned)
+  " -p " .. stprune .. long_form .. " > " .. path_seg_aligned)
 
 -- Edit and export
 fp = io.open(path_seg_aligned, "rb")
@@ -31,6 +31,7 @@
 #endif
 
 #include "external/ciglet/ciglet.h"
+#include "feature-io.h"
 
 char* mystrdup(const char *str) {
   int n = strlen(str) + 1;
@@ -39,11 +40,21 @@ char* mystrdup(const char *str) {
   return ret;
 }
 
-static void write_float_data(FP_TYPE* x, int nx) {
-  float* xfloat = calloc(nx, sizeof(float));
-  for(int i = 0; i < nx; i ++) xfloat[i] = x[i];
-  fwrite(xfloat, 4, nx, stdout);
-  free(xfloat);
+char* get_output_path(const char* input, const char* ext) {
+  int n1 = strlen(input);
+  int n2 = strlen(ext);
+  char* ret = malloc(n1 + n2 + 1);
+  strcpy(ret, input);
+  char* rext = ret + n1 - 1;
+  while(rext != ret && *rext != '.') {
+    if(*rext == '/' || *rext == '\\' || rext == ret + 1) {
+      strcpy(ret + n1, ext);
+      return ret;
+    }
+    rext --;
+  }
+  strcpy(rext, ext);
+  return ret;
 }
 
 static FP_TYPE* read_float_data(const char* path, int* nx) {
@@ -52,6 +63,7 @@ static FP_TYPE* read_float_data(const char* path, int* nx) {
     fin = stdin;
   else
     fin = fopen(path, "rb");
+  if(fin == NULL) return NULL;
   fseek(fin, 0, SEEK_END);
   int fsize = ftell(fin);
   fseek(fin, 0, SEEK_SET);
@@ -68,23 +80,52 @@ static FP_TYPE* read_float_data(const char* path, int* nx) {
   return retfp;
 }
 
-static void compute_dynamic_feature(FP_TYPE** fstatic, int nfrm, int size,
-  FP_TYPE* d, int nd, FP_TYPE** dst, int idx) {
-  int halfnd = nd / 2;
-  for(int i = 0; i < nfrm; i ++) {
-    for(int j = 0; j < size; j ++) {
-      FP_TYPE sum = 0;
-      for(int k = -halfnd; k <= halfnd; k ++)
-        if(i + k >= 0 && i + k < nfrm)
-          sum += fstatic[i + k][j] * d[k + halfnd];
-      dst[i][j + idx] = sum;
+/*
+  Regression windows for the dynamic features, one per block of nstatic
+    coefficients in an output frame, e.g. {1}, {-0.5, 0, 0.5} and
+    {0.25, 0, -0.5, 0, 0.25} for static, delta and delta-delta. Frames
+    outside the file count as zero.
+*/
+#define MAX_WINDOW 16
+
+typedef struct {
+  int n;          // odd
+  FP_TYPE* d;
+} regression_window;
+
+static int parse_window(const char* str, regression_window* dst) {
+  dst -> n = 0;
+  dst -> d = NULL;
+  const char* p = str;
+  while(*p != 0) {
+    if(*p == ',' || *p == ' ' || *p == '\t') {
+      p ++;
+      continue;
     }
+    char* end = NULL;
+    double v = strtod(p, & end);
+    if(end == p) break;
+    dst -> d = realloc(dst -> d, (dst -> n + 1) * sizeof(FP_TYPE));
+    dst -> d[dst -> n ++] = v;
+    p = end;
   }
+  if(*p != 0 || dst -> n % 2 == 0) {
+    free(dst -> d);
+    dst -> d = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+static void set_window(regression_window* dst, const FP_TYPE* d, int n) {
+  dst -> n = n;
+  dst -> d = malloc(n * sizeof(FP_TYPE));
+  memcpy(dst -> d, d, n * sizeof(FP_TYPE));
 }
 
 static void print_usage() {
   fprintf(stderr,
-    "shiro-xxcc path-to-raw-file\n"
+    "shiro-xxcc path-to-raw-file [more-raw-files ...]\n"
     "  -f feature-type (mfcc, mfbe or plpcc)\n"
     "  -m order\n"
     "  -c number-of-channels\n"
@@ -95,9 +136,12 @@ static void print_usage() {
     "  -W warp (only for mfcc and mfbe)\n"
     "  -d (include dynamic feature)\n"
     "  -a (include 2nd-order dynamic feature)\n"
+    "  -D regression-window (e.g. \"0.25,0,-0.5,0,0.25\"; can be repeated)\n"
     "  -e (include energy, if applicable)\n"
     "  -0 (include 0-th DCT coefficient)\n"
     "  -E energy-type \n"
+    "  -q encoding (f32, f16 or i8)\n"
+    "  -o output-extension (write each input to a file instead of stdout)\n"
     "  -h (print usage)\n"
     "energy-type\n"
     "   0 RMS energy\n"
@@ -105,7 +149,7 @@ static void print_usage() {
   exit(1);
 }
 
-char* input_raw = NULL;
+char* opt_extension = NULL;
 char* opt_featuretype = NULL;
 int   opt_order = 12;
 int   opt_nchannel = 36;
@@ -119,101 +163,397 @@ int   opt_a = 0;
 int   opt_0 = 0;
 int   opt_e = 0;
 int   opt_E = 0;
+int   opt_encoding = FEATURE_F32;
+regression_window opt_windows[MAX_WINDOW];
+int   opt_nwindow = 0;
 
-static void main_xxcc() {
-  int nstatic = opt_order + opt_e + opt_0;
-  int nparam = nstatic * (1 + opt_d + opt_a);
-  
-  int nx = 0;
-  FP_TYPE* x = read_float_data(input_raw, & nx);
+/*
+  Analysis context, built once and shared by every frame of every file in a
+    batch: the analysis window, an FFT plan (bit-reversal permutation and
+    twiddle factors), the filterbank and the DCT matrix, plus the per-frame
+    buffers. Frames are real, so an nfft-point frame is transformed as an
+    nfft/2-point complex sequence of its even and odd samples and only the
+    nfft/2 + 1 non-redundant bins are computed.
+  For mfcc and mfbe, the filterbank is applied as one run of nonzero weights
+    per channel (start, length, coefficients) on the magnitude or power
+    spectrum, followed by the logarithm. The runs are taken from fb -> fresp
+    between lower_idx and upper_idx; they are checked against filterbank_spec
+    on test spectra, and if they do not match, the weights are read off
+    filterbank_spec's responses to unit spectra instead, the same way the DCT
+    matrix is read off be2cc. If that does not match either, and for plpcc,
+    whose compression is left to ciglet, filterbank_spec is used per frame.
+*/
+typedef struct {
+  int nfft;
+  int framesize;
+  FP_TYPE* window;
+  int nhalf;          // nfft / 2
+  int* bitrev;        // nhalf
+  FP_TYPE* twiddle;   // nhalf complex, interleaved, exp(-2 pi i k / nfft)
+  filterbank* fb;
+  int fbmode;
+  int nchannel;
+  int ncc;
+  FP_TYPE* dct;       // ncc x nchannel
+  FP_TYPE* re;        // nhalf
+  FP_TYPE* im;        // nhalf
+  FP_TYPE* mag;       // nfft, of which the first nhalf + 1 bins are used
+  FP_TYPE* be;        // nchannel, log band energies of the current frame
+  int fbpower;        // runs over mag ^ fbpower; 0: use filterbank_spec
+  int* run_start;     // nchannel
+  int* run_len;       // nchannel
+  int* run_offset;    // nchannel, into run_coeff
+  FP_TYPE* run_coeff;
+} xxcc_context;
+
+#define FB_RUN_THRESHOLD 1e-8   // weights below this (relative) are dropped
+#define FB_RUN_TOLERANCE 1e-3   // max. log-domain deviation from ciglet
+
+// log filterbank output of the runs, floored at -15 like analyze_frame
+static void apply_fb_runs(xxcc_context* ctx, FP_TYPE* spec, FP_TYPE* dst) {
+  for(int j = 0; j < ctx -> nchannel; j ++) {
+    FP_TYPE* w = ctx -> run_coeff + ctx -> run_offset[j];
+    FP_TYPE* x = spec + ctx -> run_start[j];
+    FP_TYPE sum = 0;
+    if(ctx -> fbpower == 2)
+      for(int k = 0; k < ctx -> run_len[j]; k ++)
+        sum += w[k] * x[k] * x[k];
+    else
+      for(int k = 0; k < ctx -> run_len[j]; k ++)
+        sum += w[k] * x[k];
+    dst[j] = max(-15.0, log(sum));
+  }
+}
+
+// whether the runs reproduce filterbank_spec on a few test spectra, with the
+//   -15 floor applied to both
+static int check_fb_runs(xxcc_context* ctx, int nbin) {
+  FP_TYPE* spec = calloc(ctx -> nfft, sizeof(FP_TYPE));
+  FP_TYPE* be = calloc(ctx -> nchannel, sizeof(FP_TYPE));
+  FP_TYPE scale[3] = {1.0, 1e-4, 1e-7};
+  int ok = 1;
+  for(int n = 0; n < 3 && ok; n ++) {
+    for(int k = 0; k < nbin; k ++)
+      spec[k] = scale[n] * (1.0 + 0.5 * sin(k * 0.37) + 0.25 * cos(k * 1.91));
+    FP_TYPE* ref = filterbank_spec(ctx -> fb, spec, ctx -> nfft, opt_fs, 0);
+    apply_fb_runs(ctx, spec, be);
+    for(int j = 0; j < ctx -> nchannel && ok; j ++)
+      ok = fabs(max(-15.0, ref[j]) - be[j]) < FB_RUN_TOLERANCE;
+    free(ref);
+  }
+  free(be);
+  free(spec);
+  return ok;
+}
+
+// magnitude or power, whichever the runs reproduce ciglet with
+static int find_fb_power(xxcc_context* ctx) {
+  for(ctx -> fbpower = 1; ctx -> fbpower <= 2; ctx -> fbpower ++)
+    if(check_fb_runs(ctx, ctx -> nhalf + 1)) return 1;
+  ctx -> fbpower = 0;
+  return 0;
+}
+
+// runs straight from the filterbank's own band edges and responses
+static void set_fb_runs_from_fresp(xxcc_context* ctx) {
+  int nbin = ctx -> nhalf + 1;
+  filterbank* fb = ctx -> fb;
+  int ncoeff = 0;
+  for(int j = 0; j < ctx -> nchannel; j ++) {
+    int k0 = max(0, fb -> lower_idx[j]);
+    int k1 = min(nbin, fb -> upper_idx[j] + 1);
+    ctx -> run_start[j] = k0;
+    ctx -> run_len[j] = max(0, k1 - k0);
+    ctx -> run_offset[j] = ncoeff;
+    for(int k = k0; k < k1; k ++)
+      ctx -> run_coeff[ncoeff ++] = fb -> fresp[j][k];
+  }
+}
+
+// runs read off filterbank_spec's response to each unit spectrum
+static void set_fb_runs_from_probe(xxcc_context* ctx) {
+  int nbin = ctx -> nhalf + 1;
+  int nch = ctx -> nchannel;
+  FP_TYPE* w = calloc(nch * nbin, sizeof(FP_TYPE)); // channel-major
+  FP_TYPE* unit = calloc(ctx -> nfft, sizeof(FP_TYPE));
+  for(int k = 0; k < nbin; k ++) {
+    unit[k] = 1.0;
+    FP_TYPE* be = filterbank_spec(ctx -> fb, unit, ctx -> nfft, opt_fs, 0);
+    for(int j = 0; j < nch; j ++)
+      w[j * nbin + k] = isfinite(be[j]) ? exp(be[j]) : 0;
+    free(be);
+    unit[k] = 0;
+  }
+  free(unit);
+
+  int ncoeff = 0;
+  for(int j = 0; j < nch; j ++) {
+    FP_TYPE* wj = w + j * nbin;
+    FP_TYPE wmax = 0;
+    for(int k = 0; k < nbin; k ++) wmax = max(wmax, wj[k]);
+    int k0 = 0, k1 = nbin;
+    while(k0 < nbin && wj[k0] <= wmax * FB_RUN_THRESHOLD) k0 ++;
+    while(k1 > k0 && wj[k1 - 1] <= wmax * FB_RUN_THRESHOLD) k1 --;
+    ctx -> run_start[j] = k0;
+    ctx -> run_len[j] = k1 - k0;
+    ctx -> run_offset[j] = ncoeff;
+    for(int k = k0; k < k1; k ++)
+      ctx -> run_coeff[ncoeff ++] = wj[k];
+  }
+  free(w);
+}
+
+static void create_fb_runs(xxcc_context* ctx) {
+  int nch = ctx -> nchannel;
+  ctx -> run_start = calloc(nch, sizeof(int));
+  ctx -> run_len = calloc(nch, sizeof(int));
+  ctx -> run_offset = calloc(nch, sizeof(int));
+  ctx -> run_coeff = calloc(nch * (ctx -> nhalf + 1), sizeof(FP_TYPE));
+  if(ctx -> fb -> fresp != NULL && ctx -> fb -> lower_idx != NULL &&
+     ctx -> fb -> upper_idx != NULL) {
+    set_fb_runs_from_fresp(ctx);
+    if(find_fb_power(ctx)) return;
+  }
+  set_fb_runs_from_probe(ctx);
+  find_fb_power(ctx);
+}
+
+static xxcc_context* create_xxcc_context() {
+  xxcc_context* ret = calloc(1, sizeof(xxcc_context));
+  int nfft = max(2, pow(2, ceil(log2(opt_framesize))));
+  int nhalf = nfft / 2;
+  ret -> nfft = nfft;
+  ret -> nhalf = nhalf;
+  ret -> framesize = opt_framesize;
+  ret -> window = blackman(opt_framesize);
+
+  int nbit = 0;
+  while((1 << nbit) < nhalf) nbit ++;
+  ret -> bitrev = calloc(nhalf, sizeof(int));
+  for(int i = 0; i < nhalf; i ++) {
+    int r = 0;
+    for(int b = 0; b < nbit; b ++)
+      if(i & (1 << b)) r |= 1 << (nbit - 1 - b);
+    ret -> bitrev[i] = r;
+  }
+  ret -> twiddle = calloc(nfft + 2, sizeof(FP_TYPE));
+  for(int k = 0; k < nhalf; k ++) {
+    double phase = -2.0 * 3.14159265358979323846 * k / nfft;
+    ret -> twiddle[k * 2] = cos(phase);
+    ret -> twiddle[k * 2 + 1] = sin(phase);
+  }
 
-  int nfft = pow(2, ceil(log2(opt_framesize)));
-  filterbank* fb = NULL;
   if(! strcmp(opt_featuretype, "mfcc") || ! strcmp(opt_featuretype, "mfbe"))
-    fb = cig_create_melfreq_filterbank(nfft / 2 + 1, opt_fs / 2,
+    ret -> fb = cig_create_melfreq_filterbank(nfft / 2 + 1, opt_fs / 2,
       opt_nchannel, 50, opt_fs / 2, opt_warp, opt_minbw);
-  else if(! strcmp(opt_featuretype, "plpcc"))
-    fb = create_plpfilterbank(nfft / 2 + 1, opt_fs / 2, opt_nchannel);
-  else {
+  else if(! strcmp(opt_featuretype, "plpcc")) {
+    ret -> fb = create_plpfilterbank(nfft / 2 + 1, opt_fs / 2, opt_nchannel);
+    ret -> fbmode = 1;
+  } else {
     fprintf(stderr, "Error: undefined feature type \"%s\"\n", opt_featuretype);
     exit(1);
   }
-
-  // filtering and DCT
-
-  int nfrm = nx / opt_hopsize;
-  FP_TYPE** Be = calloc(nfrm, sizeof(FP_TYPE*));
-  FP_TYPE* energy = calloc(nfrm, sizeof(FP_TYPE));
-  FP_TYPE* w = blackman(opt_framesize);
-  for(int i = 0; i < nfrm; i ++) {
-    int center = opt_hopsize * i;
-    FP_TYPE* xfrm = fetch_frame(x, nx, center, opt_framesize);
-    FP_TYPE* fftbuff = calloc(nfft * 4, sizeof(FP_TYPE));
-    FP_TYPE* x_re = fftbuff; FP_TYPE* x_im = fftbuff + nfft;
-    for(int j = 0; j < opt_framesize; j ++) {
-      x_re[j] = xfrm[j] * w[j];
-      energy[i] += xfrm[j] * xfrm[j] * w[j];
+  ret -> nchannel = opt_nchannel;
+
+  // be2cc is linear in the band energies, so its matrix is read off from the
+  //   responses to unit vectors.
+  ret -> ncc = opt_order + opt_0;
+  ret -> dct = calloc(ret -> ncc * opt_nchannel, sizeof(FP_TYPE));
+  if(strcmp(opt_featuretype, "mfbe")) {
+    FP_TYPE* unit = calloc(opt_nchannel, sizeof(FP_TYPE));
+    for(int k = 0; k < opt_nchannel; k ++) {
+      unit[k] = 1.0;
+      FP_TYPE* cc = be2cc(unit, opt_nchannel, opt_order, opt_0);
+      for(int j = 0; j < ret -> ncc; j ++)
+        ret -> dct[j * opt_nchannel + k] = cc[j];
+      free(cc);
+      unit[k] = 0;
     }
-    energy[i] = sqrt(energy[i] / opt_framesize);
-    fft(x_re, NULL, x_re, x_im, nfft, fftbuff + nfft * 2);
-    for(int j = 0; j < nfft; j ++)
-      x_re[j] = sqrt(x_re[j] * x_re[j] + x_im[j] * x_im[j]);
-    if(! strcmp(opt_featuretype, "plpcc"))
-      Be[i] = filterbank_spec(fb, x_re, nfft, opt_fs, 1);
-    else
-      Be[i] = filterbank_spec(fb, x_re, nfft, opt_fs, 0);
-    for(int j = 0; j < opt_nchannel; j ++)
-      Be[i][j] = max(-15.0, Be[i][j]);
-    free(fftbuff);
-    free(xfrm);
+    free(unit);
   }
 
-  FP_TYPE** C = calloc(nfrm, sizeof(FP_TYPE*));
-  for(int i = 0; i < nfrm; i ++) {
-    if(! strcmp(opt_featuretype, "mfbe")) {
-      C[i] = calloc(nstatic, sizeof(FP_TYPE));
-      for(int j = 0; j < opt_order; j ++)
-        C[i][j] = Be[i][j];
-    } else {
-      C[i] = be2cc(Be[i], opt_nchannel, opt_order, opt_0);
-      if(opt_e) C[i] = realloc(C[i], nstatic * sizeof(FP_TYPE));
+  ret -> re = calloc(nhalf, sizeof(FP_TYPE));
+  ret -> im = calloc(nhalf, sizeof(FP_TYPE));
+  ret -> mag = calloc(nfft, sizeof(FP_TYPE));
+  ret -> be = calloc(ret -> nchannel, sizeof(FP_TYPE));
+  if(ret -> fbmode == 0)
+    create_fb_runs(ret);
+  return ret;
+}
+
+static void delete_xxcc_context(xxcc_context* dst) {
+  free(dst -> window);
+  free(dst -> bitrev);
+  free(dst -> twiddle);
+  delete_filterbank(dst -> fb);
+  free(dst -> dct);
+  free(dst -> re);
+  free(dst -> im);
+  free(dst -> mag);
+  free(dst -> be);
+  free(dst -> run_start);
+  free(dst -> run_len);
+  free(dst -> run_offset);
+  free(dst -> run_coeff);
+  free(dst);
+}
+
+// in-place nhalf-point radix-2 decimation-in-time FFT of ctx -> re, ctx -> im
+static void xxcc_fft(xxcc_context* ctx) {
+  int n = ctx -> nhalf;
+  FP_TYPE* re = ctx -> re;
+  FP_TYPE* im = ctx -> im;
+  for(int i = 0; i < n; i ++) {
+    int r = ctx -> bitrev[i];
+    if(r > i) {
+      FP_TYPE t = re[i]; re[i] = re[r]; re[r] = t;
+      t = im[i]; im[i] = im[r]; im[r] = t;
     }
-    if(opt_e)
-      C[i][nstatic - 1] = opt_E == 0 ? energy[i] : 20 * log10(energy[i]);
   }
+  for(int len = 2; len <= n; len <<= 1) {
+    int half = len / 2;
+    int step = ctx -> nfft / len;
+    for(int i = 0; i < n; i += len)
+      for(int k = 0; k < half; k ++) {
+        FP_TYPE wr = ctx -> twiddle[k * step * 2];
+        FP_TYPE wi = ctx -> twiddle[k * step * 2 + 1];
+        int a = i + k;
+        int b = a + half;
+        FP_TYPE tr = re[b] * wr - im[b] * wi;
+        FP_TYPE ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+  }
+}
 
-  free2d(Be, nfrm);
-  free(energy);
-
-  // differentiation
+// magnitude spectrum of a real frame packed as re[j] = x[2j], im[j] = x[2j+1]
+//   by X[k] = E[k] + exp(-2 pi i k / nfft) O[k], where E and O, the spectra of
+//   the even and odd samples, are separated from Z = fft(re + i im) using
+//   E[k] = (Z[k] + Z*[nhalf - k]) / 2, O[k] = (Z[k] - Z*[nhalf - k]) / 2i
+static void xxcc_real_magnitude(xxcc_context* ctx) {
+  int m = ctx -> nhalf;
+  FP_TYPE* re = ctx -> re;
+  FP_TYPE* im = ctx -> im;
+  ctx -> mag[0] = fabs(re[0] + im[0]);
+  ctx -> mag[m] = fabs(re[0] - im[0]);
+  for(int k = 1; k < m; k ++) {
+    FP_TYPE ar = re[k], ai = im[k];
+    FP_TYPE br = re[m - k], bi = im[m - k];
+    FP_TYPE er = (ar + br) * 0.5, ei = (ai - bi) * 0.5;
+    FP_TYPE dr = (ai + bi) * 0.5, di = (br - ar) * 0.5;
+    FP_TYPE wr = ctx -> twiddle[k * 2], wi = ctx -> twiddle[k * 2 + 1];
+    FP_TYPE xr = er + wr * dr - wi * di;
+    FP_TYPE xi = ei + wr * di + wi * dr;
+    ctx -> mag[k] = sqrt(xr * xr + xi * xi);
+  }
+}
 
-  FP_TYPE** F = malloc2d(nfrm, nparam, sizeof(FP_TYPE));
-  FP_TYPE d0[1] = {1.0};
-  int fidx = 0;
+// log band energies of the frame centered at center into ctx -> be; returns
+//   the RMS energy
+static FP_TYPE analyze_frame(xxcc_context* ctx, FP_TYPE* x, int nx,
+  int center) {
+  int offset = center - ctx -> framesize / 2;
+  FP_TYPE energy = 0;
+  memset(ctx -> re, 0, ctx -> nhalf * sizeof(FP_TYPE));
+  memset(ctx -> im, 0, ctx -> nhalf * sizeof(FP_TYPE));
+  for(int j = 0; j < ctx -> framesize; j ++) {
+    int isrc = offset + j;
+    FP_TYPE v = isrc >= 0 && isrc < nx ? x[isrc] : 0;
+    if(j & 1)
+      ctx -> im[j >> 1] = v * ctx -> window[j];
+    else
+      ctx -> re[j >> 1] = v * ctx -> window[j];
+    energy += v * v * ctx -> window[j];
+  }
+  xxcc_fft(ctx);
+  xxcc_real_magnitude(ctx);
+  if(ctx -> fbpower > 0) {
+    apply_fb_runs(ctx, ctx -> mag, ctx -> be);
+    return sqrt(energy / ctx -> framesize);
+  }
+  FP_TYPE* be = filterbank_spec(ctx -> fb, ctx -> mag, ctx -> nfft, opt_fs,
+    ctx -> fbmode);
+  for(int j = 0; j < ctx -> nchannel; j ++)
+    ctx -> be[j] = max(-15.0, be[j]);
+  free(be);
+  return sqrt(energy / ctx -> framesize);
+}
 
-  compute_dynamic_feature(C, nfrm, nstatic, d0, 1, F, fidx);
-  fidx += nstatic;
-  if(opt_d) {
-    FP_TYPE d1[3] = {-0.5, 0, 0.5};
-    compute_dynamic_feature(C, nfrm, nstatic, d1, 3, F, fidx);
-    fidx += nstatic;
+// output frame t from the frames held in the ring buffer
+static void emit_frame(FP_TYPE* ring, int nring, int nstatic, int t, int nfrm,
+  float* dst) {
+  for(int w = 0; w < opt_nwindow; w ++) {
+    FP_TYPE* d = opt_windows[w].d;
+    int half = opt_windows[w].n / 2;
+    int k0 = max(0, half - t);
+    int k1 = min(opt_windows[w].n, nfrm - t + half);
+    for(int j = 0; j < nstatic; j ++) {
+      FP_TYPE sum = 0;
+      for(int k = k0; k < k1; k ++)
+        sum += ring[((t + k - half) % nring) * nstatic + j] * d[k];
+      dst[j] = sum;
+    }
+    dst += nstatic;
   }
-  if(opt_a) {
-    FP_TYPE d2[5] = {0.25, 0, -0.5, 0, 0.25};
-    compute_dynamic_feature(C, nfrm, nstatic, d2, 5, F, fidx);
+}
+
+static int main_xxcc(xxcc_context* ctx, const char* input, FILE* fout) {
+  int nstatic = opt_order + opt_e + opt_0;
+  int nparam = nstatic * opt_nwindow;
+  int maxhalf = 0;
+  for(int w = 0; w < opt_nwindow; w ++)
+    maxhalf = max(maxhalf, opt_windows[w].n / 2);
+  
+  int nx = 0;
+  FP_TYPE* x = read_float_data(input, & nx);
+  if(x == NULL) {
+    fprintf(stderr, "Error: cannot open %s.\n", input);
+    return 1;
   }
 
-  // output
+  // Filtering, DCT and differentiation in one pass: the static coefficients
+  //   of frame i go into a ring buffer of 2 maxhalf + 1 frames, and frame
+  //   i - maxhalf, whose context is then complete, is written out.
 
-  FP_TYPE* Fout = flatten(F, nfrm, nparam, sizeof(FP_TYPE));
-  write_float_data(Fout, nfrm * nparam);
-  free(Fout);
+  int nfrm = nx / opt_hopsize;
+  int nring = 2 * maxhalf + 1;
+  FP_TYPE* ring = calloc(nring * nstatic, sizeof(FP_TYPE));
+  float* out = calloc((long)nfrm * nparam + 1, sizeof(float));
+  FP_TYPE* be = ctx -> be;
+  int is_mfbe = ! strcmp(opt_featuretype, "mfbe");
+  for(int i = 0; i < nfrm + maxhalf; i ++) {
+    if(i < nfrm) {
+      FP_TYPE* c = ring + (i % nring) * nstatic;
+      int center = opt_hopsize * i;
+      FP_TYPE energy = analyze_frame(ctx, x, nx, center);
+      for(int j = 0; j < ctx -> ncc; j ++) {
+        if(is_mfbe) {
+          c[j] = j < opt_order ? be[j] : 0;
+          continue;
+        }
+        FP_TYPE* row = ctx -> dct + j * ctx -> nchannel;
+        FP_TYPE sum = 0;
+        for(int k = 0; k < ctx -> nchannel; k ++)
+          sum += row[k] * be[k];
+        c[j] = sum;
+      }
+      if(opt_e)
+        c[nstatic - 1] = opt_E == 0 ? energy : 20 * log10(energy);
+    }
+    int t = i - maxhalf;
+    if(t >= 0)
+      emit_frame(ring, nring, nstatic, t, nfrm, out + (long)t * nparam);
+  }
+  free(ring);
 
-  free2d(F, nfrm);
-  free2d(C, nfrm);
+  write_feature_data(fout, out, nfrm, nparam, opt_encoding);
 
-  delete_filterbank(fb);
+  free(out);
   free(x);
+  return 0;
 }
 
 extern char* optarg;
@@ -223,8 +563,10 @@ int main(int argc, char** argv) {
 # endif
   int c;
   opt_featuretype = mystrdup("mfcc");
+  regression_window extra_windows[MAX_WINDOW];
+  int nextra = 0;
 
-  while((c = getopt(argc, argv, "f:m:c:l:p:w:s:W:da0eE:h")) != -1) {
+  while((c = getopt(argc, argv, "f:m:c:l:p:w:s:W:daD:0eE:q:o:h")) != -1) {
     switch(c) {
     case 'f':
       free(opt_featuretype);
@@ -285,6 +627,18 @@ int main(int argc, char** argv) {
     case 'a':
       opt_a = 1;
     break;
+    case 'D':
+      if(nextra >= MAX_WINDOW - 3) {
+        fprintf(stderr, "Error: too many regression windows.\n");
+        exit(1);
+      }
+      if(! parse_window(optarg, & extra_windows[nextra])) {
+        fprintf(stderr, "Error: invalid regression window \"%s\" (expecting "
+          "an odd number of coefficients)\n", optarg);
+        exit(1);
+      }
+      nextra ++;
+    break;
     case '0':
       opt_0 = 1;
     break;
@@ -294,6 +648,17 @@ int main(int argc, char** argv) {
     case 'E':
       opt_E = atoi(optarg);
     break;
+    case 'q':
+      opt_encoding = parse_feature_encoding(optarg);
+      if(opt_encoding < 0) {
+        fprintf(stderr, "Error: undefined encoding \"%s\"\n", optarg);
+        exit(1);
+      }
+    break;
+    case 'o':
+      free(opt_extension);
+      opt_extension = mystrdup(optarg);
+    break;
     case 'h':
       print_usage();
     break;
@@ -303,14 +668,47 @@ int main(int argc, char** argv) {
   }
   opt_nchannel = max(opt_nchannel, opt_order + 1);
 
-  if(optind >= argc) {
-    input_raw = mystrdup("-");
-  } else
-    input_raw = mystrdup(argv[optind]);
+  const FP_TYPE d0[1] = {1.0};
+  const FP_TYPE d1[3] = {-0.5, 0, 0.5};
+  const FP_TYPE d2[5] = {0.25, 0, -0.5, 0, 0.25};
+  set_window(& opt_windows[opt_nwindow ++], d0, 1);
+  if(opt_d) set_window(& opt_windows[opt_nwindow ++], d1, 3);
+  if(opt_a) set_window(& opt_windows[opt_nwindow ++], d2, 5);
+  for(int i = 0; i < nextra; i ++)
+    opt_windows[opt_nwindow ++] = extra_windows[i];
+
+  if(argc - optind > 1 && opt_extension == NULL) {
+    fprintf(stderr, "Error: an output extension (-o) is required for "
+      "multiple inputs.\n");
+    exit(1);
+  }
 
-  main_xxcc();
+  // A batch shares one analysis context.
+  xxcc_context* ctx = create_xxcc_context();
+  int ret = 0;
+  if(optind >= argc)
+    ret = main_xxcc(ctx, "-", stdout);
+  for(int i = optind; i < argc && ret == 0; i ++) {
+    if(opt_extension == NULL) {
+      ret = main_xxcc(ctx, argv[i], stdout);
+      continue;
+    }
+    char* output = get_output_path(argv[i], opt_extension);
+    FILE* fout = fopen(output, "wb");
+    if(fout == NULL) {
+      fprintf(stderr, "Error: cannot write to %s\n", output);
+      ret = 1;
+    } else {
+      ret = main_xxcc(ctx, argv[i], fout);
+      fclose(fout);
+    }
+    free(output);
+  }
+  delete_xxcc_context(ctx);
+  for(int i = 0; i < opt_nwindow; i ++)
+    free(opt_windows[i].d);
 
   free(opt_featuretype);
-  free(input_raw);
-  return 0;
+  free(opt_extension);
+  return ret;
 }